@@ -0,0 +1,566 @@
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+
+#include "csv.hpp"
+#include "expr.hpp"
+#include "grammar.hpp"
+#include "json.hpp"
+#include "walker.hpp"
+
+// Benchmarks the parser primitives and the README examples.
+// Prints one CSV line per case with the throughput in MB/s.
+//
+// Usage: bench [max size] [name filter]
+//   bench            runs every case on inputs from 1K to 1G
+//   bench 1M Until   runs the cases named Until up to 1M
+
+// Keeps the compiler from optimizing the measured work away.
+volatile size_t sink;
+
+// Runs f until at least 200ms have passed and returns the
+// throughput in MB/s, for the given bytes read by each run.
+template <typename F>
+double Measure(size_t size, F f)
+{
+    using clock = std::chrono::steady_clock;
+    size_t bytes = 0;
+    auto start = clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+        f();
+        bytes += size;
+        elapsed = clock::now() - start;
+    } while (elapsed.count() < 0.2);
+    return bytes / elapsed.count() / 1e6;
+}
+
+// Runs f on the text until at least 200ms have passed
+// and returns the throughput in MB/s.
+template <typename F>
+double Measure(std::string_view text, F f)
+{
+    return Measure(text.size(), [&]() {
+        Parser p(text);
+        f(p);
+        sink = p.Tail().size();
+    });
+}
+
+std::string filter;
+
+template <typename F>
+void Bench(std::string_view name, const std::string& text, F f)
+{
+    if (name.find(filter) == std::string_view::npos) {
+        return;
+    }
+    // Padded, so the cases also run with WALKER_PADDED.
+    PaddedString padded(text);
+    Parser p(padded);
+    f(p);
+    if (p.More()) {
+        std::cerr << name << ": stopped before the end of the input" << std::endl;
+        return;
+    }
+    std::cout << name << "," << text.size() << "," << Measure(padded, f) << std::endl;
+}
+
+// Runs f on the values, for the cases that read numbers, not text.
+template <typename F>
+void Bench(std::string_view name, const std::vector<double>& values, F f)
+{
+    if (name.find(filter) == std::string_view::npos) {
+        return;
+    }
+    auto bytes = values.size() * sizeof(double);
+    std::cout << name << "," << bytes << "," << Measure(bytes, [&]() { f(values); }) << std::endl;
+}
+
+// Returns the record repeated until the text has about size bytes.
+std::string Repeat(std::string_view record, size_t size)
+{
+    std::string text;
+    text.reserve(size + record.size());
+    while (text.size() < size) {
+        text += record;
+    }
+    return text;
+}
+
+// Compares the character at a time loops the scanning primitives used
+// to run with every scanning backend.
+void BenchScan(size_t size)
+{
+    auto word = std::string(size, 'a');
+    auto line = word + "\n";
+    auto space = std::string(size, ' ') + "x";
+    auto multilingual = Repeat("Gr\xC3\xBC\xC3\x9F" "e, \xD0\xBC\xD0\xB8\xD1\x80! \xE4\xB8\x96\xE7\x95\x8C \xF0\x9F\x98\x80 ", size);
+
+    Bench("loop/Until(char)", line, [](Parser& p) { while (p.Not('\n')) { } p.Any(); });
+    Bench("loop/Until(char,char)", line, [](Parser& p) { while (p.Not('\n', ',')) { } p.Any(); });
+    Bench("loop/While(range)", word, [](Parser& p) { while (p.Match({ 'a', 'z' })) { } });
+    Bench("loop/Space", space, [](Parser& p) { while (p.Match({ '\0' + 1, ' ' })) { } p.Any(); });
+
+    std::vector<const scan::Backend*> backends = { &scan::Scalar };
+#ifdef WALKER_X86
+    backends.push_back(&scan::Sse2);
+    if (__builtin_cpu_supports("avx2")) {
+        backends.push_back(&scan::Avx2);
+    }
+#endif
+    for (auto b : backends) {
+        scan::Use(*b);
+        auto name = std::string(b->name);
+        Bench(name + "/Until(char)", line, [](Parser& p) { p.Until('\n') && p.Any(); });
+        Bench(name + "/Until(char,char)", line, [](Parser& p) { p.Until('\n', ',') && p.Any(); });
+        Bench(name + "/While(range)", word, [](Parser& p) { p.While({ 'a', 'z' }); });
+        Bench(name + "/Space", space, [](Parser& p) { p.Space() && p.Any(); });
+        Bench(name + "/ValidUtf8", word, [](Parser& p) { p.ValidUtf8() && (p.Advance(p.Tail().size()), true); });
+        Bench(name + "/ValidUtf8(multilingual)", multilingual, [](Parser& p) { p.ValidUtf8() && (p.Advance(p.Tail().size()), true); });
+    }
+    scan::Use(scan::Best());
+}
+
+void BenchPrimitives(size_t size)
+{
+    auto lines = Repeat("2024-01-01 12:00:00 INFO request handled in 12ms by worker 7\n", size);
+    Bench("Space", Repeat("        x", size), [](Parser& p) {
+        while (p.Space() && p.Match('x')) { }
+    });
+    Bench("Until", lines, [](Parser& p) {
+        while (p.Until('\n') && p.Any()) { }
+    });
+    Bench("Until(string)", lines, [](Parser& p) {
+        while (p.Until("INFO") && p.Any()) { }
+    });
+    Bench("Until(Patterns)", lines, [](Parser& p) {
+        static const Patterns levels = { "ERROR", "WARN", "INFO" };
+        while (p.Until(levels) && p.Any()) { }
+    });
+    Bench("While", Repeat("identifier_name ", size), [](Parser& p) {
+        while (p.While({ 'a', 'z' }, { '_', '_' }) && p.Any()) { }
+    });
+    Bench("While(CharSet)", Repeat("identifier_name_2 ", size), [](Parser& p) {
+        static constexpr CharSet ident("a-zA-Z0-9_");
+        while (p.While(ident) && p.Any()) { }
+    });
+    Bench("While(UnicodeClass)", Repeat("identifier stra\xC3\x9F" "e \xCE\xB1\xCE\xB2\xCE\xB3 ", size), [](Parser& p) {
+        static const UnicodeClass letters({ { 'a', 'z' }, { 0xC0, 0x24F }, { 0x391, 0x3C9 } });
+        while (p.While(letters) && p.Any()) { }
+    });
+    Bench("Until(CharSet)", lines, [](Parser& p) {
+        static constexpr CharSet stop("\n;");
+        while (p.Until(stop) && p.Any()) { }
+    });
+    Bench("String", Repeat(R"("hello \"quoted\" world",)", size), [](Parser& p) {
+        while (p.String('"') && p.Any()) { }
+    });
+    Bench("String(long)", Repeat(R"("a long quoted value that spans several vector blocks \"here\"",)", size), [](Parser& p) {
+        while (p.String('"') && p.Any()) { }
+    });
+    Bench("String(unescape)", Repeat(R"("a long quoted value that spans several vector blocks \"here\"",)", size), [](Parser& p) {
+        static std::string out;
+        while (p.String('"', out) && p.Any()) { }
+    });
+    Bench("Float", Repeat("-123.456e7,", size), [](Parser& p) {
+        while (p.Float() && p.Any()) { }
+    });
+    Bench("Integer", Repeat("1234567,", size), [](Parser& p) {
+        while (p.Integer() && p.Any()) { }
+    });
+    Bench("Number(double)", Repeat("-123.456e7,", size), [](Parser& p) {
+        double v;
+        while (p.Number(v) && p.Any()) { }
+    });
+    Bench("Number(int64_t)", Repeat("1234567,", size), [](Parser& p) {
+        int64_t v;
+        while (p.Number(v) && p.Any()) { }
+    });
+    Bench("Line", lines, [](Parser& p) {
+        while (p.Line()) { }
+    });
+    Bench("Out(Tokens)", Repeat("word 12345 other 7 ", size), [](Parser& p) {
+        static Tokens out;
+        out.Clear();
+        for (;;) {
+            p.Space();
+            auto m = p.Mark();
+            if (!p.Out(m, p.While({ 'a', 'z' }), out, 0) && !p.Out(m, p.While({ '0', '9' }), out, 1)) {
+                break;
+            }
+        }
+    });
+    Bench("Out(vector<string_view>)", Repeat("word 12345 other 7 ", size), [](Parser& p) {
+        static std::vector<std::string_view> out;
+        out.clear();
+        for (;;) {
+            p.Space();
+            auto m = p.Mark();
+            if (!p.Out(m, p.While({ 'a', 'z' }), out) && !p.Out(m, p.While({ '0', '9' }), out)) {
+                break;
+            }
+        }
+    });
+}
+
+// The Example_Expr grammar of test.cpp, run on one expression per line.
+void BenchExpr(size_t size)
+{
+    Bench("Example_Expr", Repeat("(6-1)*4*2+(1+3)*(16/2)\n", size), [](Parser& p) {
+        std::function<bool(int&)> expr, term, fact;
+        expr = [&](int& out) {
+            if (term(out)) {
+                int r;
+                if (p.Match('+') && expr(r)) {
+                    out += r;
+                } else if (p.Match('-') && expr(r)) {
+                    out -= r;
+                }
+                return true;
+            }
+            return false;
+        };
+        term = [&](int& out) {
+            if (fact(out)) {
+                int r;
+                if (p.Match('*') && term(r)) {
+                    out *= r;
+                } else if (p.Match('/') && term(r)) {
+                    out /= r;
+                }
+                return true;
+            }
+            return false;
+        };
+        fact = [&](int& out) {
+            return (p.Match('(') && expr(out) && p.Match(')')) || p.Number(out);
+        };
+        int out;
+        while (expr(out) && p.Match('\n')) { }
+    });
+}
+
+// The Example_Json grammar of test.cpp, run on an array of objects.
+void BenchJson(size_t size)
+{
+    auto text = "[" + Repeat(R"({ "name": "John", "country": [ "USA", "BRAZIL" ] }, )", size) + "{}]";
+    Bench("Example_Json", text, [](Parser& p) {
+        std::function<bool(std::string&)> jsn, obj, arr, str, key;
+        jsn = [&](std::string& out) {
+            p.Space();
+            return obj(out) || arr(out) || str(out);
+        };
+        obj = [&](std::string& out) {
+            if (p.Match('{')) {
+                if (key(out)) {
+                    while (p.Match(',') && key(out)) { }
+                }
+                p.Space();
+                return p.Match('}');
+            }
+            return false;
+        };
+        arr = [&](std::string& out) {
+            if (p.Match('[')) {
+                if (jsn(out)) {
+                    while (p.Match(',') && jsn(out)) { }
+                }
+                p.Space();
+                return p.Match(']');
+            }
+            return false;
+        };
+        str = [&](std::string& out) {
+            auto m = p.Mark();
+            if (p.String('"')) {
+                out = p.Token(m);
+                return true;
+            }
+            return false;
+        };
+        key = [&](std::string& out) {
+            p.Space();
+            return p.String('"') && p.Match(':') && jsn(out);
+        };
+        std::string out;
+        jsn(out);
+    });
+    Bench("Example_Json(tree)", text, [](Parser& p) {
+        enum { Object, Array, String };
+        static Tree tree;
+        tree.Clear();
+        p.Build(tree);
+        std::function<bool()> jsn, obj, arr, str, key;
+        jsn = [&]() {
+            p.Space();
+            return obj() || arr() || str();
+        };
+        obj = [&]() {
+            return p.Close(p.Open(Object) && p.Match('{') && [&]() {
+                if (key()) {
+                    while (p.Match(',') && key()) { }
+                }
+                p.Space();
+                return p.Match('}');
+            }());
+        };
+        arr = [&]() {
+            return p.Close(p.Open(Array) && p.Match('[') && [&]() {
+                if (jsn()) {
+                    while (p.Match(',') && jsn()) { }
+                }
+                p.Space();
+                return p.Match(']');
+            }());
+        };
+        str = [&]() {
+            return p.Close(p.Open(String) && p.String('"'));
+        };
+        key = [&]() {
+            p.Space();
+            return p.String('"') && p.Match(':') && jsn();
+        };
+        jsn();
+    });
+    Bench("Json", text, [](Parser& p) {
+        static Json doc;
+        if (doc.Parse(p.Tail())) {
+            p.Advance(p.Tail().size());
+        }
+    });
+    auto pretty = "[\n" + Repeat("    {\n        \"id\": 12345,\n        \"value\": -1.5e3,\n        \"tags\": [ \"x\", \"y\" ]\n    },\n", size) + "    {}\n]";
+    Bench("Json(pretty)", pretty, [](Parser& p) {
+        static Json doc;
+        if (doc.Parse(p.Tail())) {
+            p.Advance(p.Tail().size());
+        }
+    });
+}
+
+// Reads two fields of 5K documents, one per line, parsing each document
+// whole or only up to the fields.
+void BenchJsonFields(size_t size)
+{
+    auto item = std::string(R"({ "id": 123456, "name": "item name", "tags": [ "a", "b", "c" ], "price": 12.5 }, )");
+    auto record = R"({ "items": [ )" + ::Repeat(item, 5000) + R"({} ], "user": { "id": 42, "name": "John" }, "status": "ok" })" + "\n";
+    auto text = ::Repeat(record, size);
+    Bench("Json(fields)", text, [](Parser& p) {
+        static Json doc;
+        for (auto m = p.Mark(); p.Until('\n'); m = p.Mark()) {
+            int64_t id;
+            std::string_view status;
+            std::string storage;
+            if (doc.Parse(p.Token(m))) {
+                doc.Root()["user"]["id"].Get(id);
+                doc.Root()["status"].Get(status, storage);
+            }
+            p.Next();
+        }
+    });
+    Bench("JsonCursor(fields)", text, [](Parser& p) {
+        for (auto m = p.Mark(); p.Until('\n'); m = p.Mark()) {
+            int64_t id;
+            std::string status;
+            JsonCursor doc(p.Token(m));
+            doc["user"]["id"].Get(id);
+            doc["status"].Get(status);
+            p.Next();
+        }
+    });
+}
+
+// The Example_Json grammar written with grammar.hpp combinators.
+void BenchGrammar(size_t size)
+{
+    using namespace grammar;
+    auto text = "[" + ::Repeat(R"({ "name": "John", "country": [ "USA", "BRAZIL" ] }, )", size) + "{}]";
+    Rule jsn;
+    auto key = Space() >> String('"') >> ':' >> jsn;
+    auto obj = '{' >> -(key >> *(',' >> key)) >> Space() >> '}';
+    auto arr = '[' >> -(jsn >> *(',' >> jsn)) >> Space() >> ']';
+    jsn = Space() >> (obj | arr | String('"'));
+    Bench("Grammar_Json", text, [&](Parser& p) { jsn(p); });
+
+    // Many alternatives that each start with different characters.
+    auto code = ::Repeat("while (x1 < 100) { total = total + x1 * 2; x1 = x1 + 1; }\n", size);
+    auto token = Str("while") | Str("if") | Str("else") | Str("return") | +In('a', 'z') >> *In('0', '9')
+        | Integer() | '(' | ')' | '{' | '}' | ';' | '=' | '<' | '+' | '*';
+    auto tokens = *(Space() >> token) >> Space();
+    Bench("Grammar_Tokens", code, [&](Parser& p) { tokens(p); });
+}
+
+// Reads a CSV file of four columns, with the parser primitives
+// and with CsvReader.
+void BenchCsv(size_t size)
+{
+    auto text = ::Repeat("12345,John Smith,\"Sao Paulo, Brazil\",-123.25\n", size);
+    Bench("Csv(loop)", text, [](Parser& p) {
+        static std::vector<std::string_view> fields;
+        while (p.More()) {
+            fields.clear();
+            do {
+                auto m = p.Mark();
+                if (p.String('"')) {
+                    fields.push_back(p.Token(m));
+                } else {
+                    p.Until(',', '\n');
+                    fields.push_back(p.Token(m));
+                }
+            } while (p.Match(','));
+            p.Match('\n');
+        }
+    });
+    Bench("Csv", text, [](Parser& p) {
+        static std::vector<std::string_view> fields;
+        CsvReader r(p.Tail());
+        while (r.Next(fields)) { }
+        p.Advance(p.Tail().size());
+    });
+    Bench("Csv(columns)", text, [](Parser& p) {
+        static std::vector<int64_t> ids;
+        static std::vector<std::string_view> names, cities;
+        static std::vector<double> values;
+        ids.clear(), names.clear(), cities.clear(), values.clear();
+        CsvReader r(p.Tail());
+        while (r.Batch(1024, ids, names, cities, values)) { }
+        p.Advance(p.Tail().size());
+    });
+    auto plain = ::Repeat("12345,John Smith,Sao Paulo,-123.25\n", size);
+    Bench("Csv(parallel)", plain, [](Parser& p) {
+        ParseCsvParallel(p.Tail(), [](CsvReader& r) {
+            std::vector<std::string_view> fields;
+            size_t n = 0;
+            while (r.Next(fields)) {
+                n += fields.size();
+            }
+            return n;
+        });
+        p.Advance(p.Tail().size());
+    });
+}
+
+// Evaluates a formula for bindings of three variables, compiling it for
+// each binding, or once for rows or columns of bindings. The input is
+// the bindings as raw doubles.
+void BenchEval(size_t size)
+{
+    static const std::string_view formula = "a * (1 - b) + c * 2.5 - a / (b + 1)";
+    static const std::vector<std::string_view> vars = { "a", "b", "c" };
+    // Bindings of the three variables, read as rows or as columns.
+    std::vector<double> values(size / 24 * 3);
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = i % 100 * 0.25;
+    }
+    Bench("Expr(compile each)", values, [](const std::vector<double>& values) {
+        auto n = values.size() / 3;
+        Expr e;
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            e.Compile(formula, vars);
+            sum += e.Eval(values.data() + i * 3);
+        }
+        sink = sum;
+    });
+    Bench("Expr(rows)", values, [](const std::vector<double>& values) {
+        static std::vector<double> out;
+        auto n = values.size() / 3;
+        out.resize(n);
+        Expr e;
+        e.Compile(formula, vars);
+        e.Eval(values.data(), n, out.data());
+        sink = out.size();
+    });
+    Bench("Expr(columns)", values, [](const std::vector<double>& values) {
+        static std::vector<double> out;
+        auto n = values.size() / 3;
+        out.resize(n);
+        const double* columns[] = { values.data(), values.data() + n, values.data() + 2 * n };
+        Expr e;
+        e.Compile(formula, vars);
+        e.Eval(columns, n, out.data());
+        sink = out.size();
+    });
+}
+
+// Parses a document of statements with a memoized rule each time, and
+// after changing one digit in its middle, which replays the statements
+// away from the edit.
+void BenchMemo(size_t size)
+{
+    // The memo and the copies of the document take several times its
+    // size, which is too much for the largest documents.
+    if (size > 1 << 25) {
+        return;
+    }
+    static const auto statement = [](Parser& p) {
+        auto m = p.Mark();
+        bool ok = p.While({ 'a', 'z' }) && p.Match('=') && p.Match('[') && p.Integer();
+        while (ok && p.Match(',')) {
+            ok = p.Integer();
+        }
+        return p.Undo(m, ok && p.Match(']') && p.Match(';') && p.Space());
+    };
+    auto text = Repeat("values=[12345,67890,13579,24680,11111,22222,33333,44444];\n", size);
+    Bench("Memo(full)", text, [](Parser& p) {
+        Memo memo;
+        while (memo.Run(p, 1, [&]() { return statement(p); })) { }
+    });
+    // The two versions of the document take turns.
+    static PaddedString versions[2];
+    static size_t offset;
+    static Memo memo;
+    static int turn;
+    offset = text.find('[', text.size() / 2) + 1;
+    versions[0] = PaddedString(text);
+    auto digit = text[offset];
+    text[offset] = '9';
+    versions[1] = PaddedString(text);
+    text[offset] = digit;
+    memo.Clear();
+    turn = 0;
+    Bench("Memo(edit)", text, [](Parser& p) {
+        memo.Edit(versions[turn].View().size(), offset, 1, 1);
+        turn ^= 1;
+        Parser q(versions[turn]);
+        while (memo.Run(q, 1, [&]() { return statement(q); })) { }
+        p.Advance(p.Tail().size() - q.Tail().size());
+    });
+}
+
+// Parses sizes such as 4096, 64K, 1M or 1G.
+size_t ParseSize(std::string_view s)
+{
+    Parser p(s);
+    uint64_t n = 0;
+    p.Number(n);
+    if (p.Match('K', 'k')) {
+        n <<= 10;
+    } else if (p.Match('M', 'm')) {
+        n <<= 20;
+    } else if (p.Match('G', 'g')) {
+        n <<= 30;
+    }
+    return n;
+}
+
+int main(int argc, char** argv)
+{
+    size_t max = argc > 1 ? ParseSize(argv[1]) : 1 << 30;
+    filter = argc > 2 ? argv[2] : "";
+
+    std::cout << "name,bytes,mb_per_s" << std::endl;
+    BenchScan(std::min<size_t>(max, 1 << 20));
+    for (size_t size = 1 << 10; size <= max; size <<= 5) {
+        BenchPrimitives(size);
+        BenchExpr(size);
+        BenchEval(size);
+        BenchJson(size);
+        BenchGrammar(size);
+        BenchJsonFields(size);
+        BenchCsv(size);
+        BenchMemo(size);
+    }
+    return 0;
+}
@@ -1,24 +1,45 @@
 import os
 import platform
+import sys
 
-def build_mac():
+def build_mac(name, flags, args):
     build = " ".join([
-        "g++ test.cpp -std=c++20 -Wall -o test",
+        f"g++ {name}.cpp -std=c++20 -Wall -pthread {flags} -o {name}",
     ])
-    os.system(build)
-    os.system("./test")
-    os.remove("./test")
+    ok = os.system(build) == 0 and os.system(f"./{name} {args}") == 0
+    if os.path.exists(f"./{name}"):
+        os.remove(f"./{name}")
+    return ok
 
-def build_win():
+def build_win(name, flags, args):
     build = " ".join([
-        "g++ test.cpp -std=c++20 -Wall -o test.exe",
+        f"g++ {name}.cpp -std=c++20 -Wall -pthread {flags} -o {name}.exe",
     ])
-    os.system(build)
-    os.system("test.exe")
-    os.remove("test.exe")
+    ok = os.system(build) == 0 and os.system(f"{name}.exe {args}") == 0
+    if os.path.exists(f"{name}.exe"):
+        os.remove(f"{name}.exe")
+    return ok
+
+# The test suite built with each compile-time mode of walker.hpp.
+tests = {
+    "test": ("test", "", ""),
+    "padded": ("test", "-DWALKER_PADDED", ""),
+    "profile": ("test", "-DWALKER_PROFILE", ""),
+    "expected": ("test", "-DWALKER_EXPECTED", ""),
+}
 
 # python build.py
-if platform.system() == "Windows":
-    build_win()
+# python build.py padded|profile|expected|all
+# python build.py bench [max size] [name filter]
+if len(sys.argv) > 1 and sys.argv[1] == "bench":
+    targets = [("bench", "-O2", " ".join(sys.argv[2:]))]
+elif len(sys.argv) > 1 and sys.argv[1] == "all":
+    targets = list(tests.values())
 else:
-    build_mac()
+    targets = [tests[sys.argv[1] if len(sys.argv) > 1 else "test"]]
+
+build = build_win if platform.system() == "Windows" else build_mac
+failed = [t[1] or "default" for t in targets if not build(*t)]
+if failed:
+    print("failed: " + ", ".join(failed))
+    sys.exit(1)
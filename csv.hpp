@@ -0,0 +1,244 @@
+#ifndef CSV_HPP
+#define CSV_HPP
+
+#include "parallel.hpp"
+#include "walker.hpp"
+
+// Reader of CSV text as defined by RFC 4180, or of TSV and the like
+// with another delimiter.
+// Finds delimiters, quotes and newlines 64 characters at a time with
+// the scan kernels. The characters inside quotes are found by xoring
+// together the bits of the quotes before them, which also handles
+// doubled quotes, so quoting costs nothing extra.
+// Fields are views of the text, which must outlive the reader.
+class CsvReader {
+public:
+    CsvReader(std::string_view text, char delim = ',');
+
+    // Reads the fields of the next record.
+    // Quoted fields are returned without their quotes, but with their
+    // doubled quotes; see Unquote. Carriage returns before newlines
+    // are dropped. Returns false at the end of the text.
+    bool Next(std::vector<std::string_view>& fields);
+    // Reads up to n records, appending their first fields to the
+    // columns, one column per field. Numbers are converted with
+    // Parser::Number, and string_view columns take the fields as they are.
+    // Stops at a record whose fields do not convert, or that has too
+    // few fields, and leaves it for the next call to Next.
+    // Returns the number of records read.
+    template <typename... T>
+    size_t Batch(size_t n, std::vector<T>&... columns);
+    // Replaces the doubled quotes of a quoted field.
+    static void Unquote(std::string_view field, std::string& out);
+
+private:
+    bool Read(std::vector<std::string_view>& fields);
+    // Finds the separators of the next blocks of text.
+    bool Index();
+    // Returns the field without its quotes or carriage return.
+    static std::string_view Field(const char* p, const char* e, bool last);
+    template <typename T>
+    bool Convert(std::string_view field, std::vector<T>& column);
+
+    std::string_view text;
+    char delim;
+    // Start of the next field.
+    size_t pos = 0;
+    // Offset of the first block not indexed yet.
+    size_t indexed = 0;
+    // Whether the text indexed so far ends inside quotes.
+    bool quoted = false;
+    // Separators found but not read yet, as offset * 2 + 1 for newlines.
+    std::vector<uint64_t> separators;
+    size_t next = 0;
+    // Record left unread by Batch, returned by the next read.
+    std::vector<std::string_view> record;
+    bool held = false;
+};
+
+// Splits the text into chunks of records, runs f on a CsvReader over
+// each chunk on a pool of threads and returns the results in order.
+// The text must not have quoted newlines, as chunks are split at
+// newlines without looking at quotes.
+template <typename F>
+auto ParseCsvParallel(std::string_view text, F f, size_t chunks = 0, char delim = ',')
+    -> std::vector<std::invoke_result_t<F, CsvReader&>>;
+
+CsvReader::CsvReader(std::string_view text, char delim)
+    : text(text)
+    , delim(delim)
+{
+}
+
+bool CsvReader::Next(std::vector<std::string_view>& fields)
+{
+    if (held) {
+        held = false;
+        fields.assign(record.begin(), record.end());
+        return true;
+    }
+    return Read(fields);
+}
+
+template <typename... T>
+size_t CsvReader::Batch(size_t n, std::vector<T>&... columns)
+{
+    size_t count = 0;
+    for (; count < n; count++) {
+        if (!held && !Read(record)) {
+            break;
+        }
+        held = true;
+        auto sizes = { columns.size()... };
+        size_t i = 0;
+        if (record.size() < sizeof...(T) || !(Convert(record[i++], columns) && ...)) {
+            // Leaves the columns as they were.
+            auto size = sizes.begin();
+            (columns.resize(*size++), ...);
+            break;
+        }
+        held = false;
+    }
+    return count;
+}
+
+void CsvReader::Unquote(std::string_view field, std::string& out)
+{
+    out.clear();
+    for (size_t i = 0; i < field.size(); i++) {
+        out += field[i];
+        if (field[i] == '"' && i + 1 < field.size() && field[i + 1] == '"') {
+            i++;
+        }
+    }
+}
+
+bool CsvReader::Read(std::vector<std::string_view>& fields)
+{
+    fields.clear();
+    if (pos >= text.size()) {
+        return false;
+    }
+    for (;;) {
+        if (next == separators.size() && !Index()) {
+            // The last record has no newline.
+            fields.push_back(Field(text.data() + pos, text.data() + text.size(), true));
+            pos = text.size();
+            return true;
+        }
+        // Works on copies, as the fields could alias the members.
+        auto data = text.data();
+        auto start = pos;
+        auto i = next;
+        auto s = separators.data();
+        auto n = separators.size();
+        for (; i < n; i++) {
+            auto end = s[i] / 2;
+            bool last = s[i] & 1;
+            fields.push_back(Field(data + start, data + end, last));
+            start = end + 1;
+            if (last) {
+                pos = start;
+                next = i + 1;
+                return true;
+            }
+        }
+        pos = start;
+        next = i;
+    }
+}
+
+bool CsvReader::Index()
+{
+    if (indexed >= text.size()) {
+        return false;
+    }
+    separators.resize(1024);
+    size_t count = 0;
+    next = 0;
+    const char chars[] = { delim, '"', '\n' };
+    auto stop = std::min(text.size(), indexed + 1024);
+    for (; indexed < stop; indexed += 64) {
+        auto block = text.data() + indexed;
+        uint64_t m[3];
+#ifdef WALKER_PADDED
+        // The last block reads into the padding, whose bits are dropped.
+        scan::Masks(block, chars, 3, m);
+        if (text.size() - indexed < 64) {
+            auto valid = (uint64_t(1) << (text.size() - indexed)) - 1;
+            for (auto& x : m) {
+                x &= valid;
+            }
+        }
+#else
+        // The last block is copied with a filler that is none of the chars.
+        char buf[64];
+        if (text.size() - indexed < 64) {
+            std::fill(buf, buf + 64, delim == ' ' ? 'x' : ' ');
+            std::copy(block, text.data() + text.size(), buf);
+            block = buf;
+        }
+        scan::Masks(block, chars, 3, m);
+#endif
+        uint64_t inside = quoted ? ~uint64_t(0) : 0;
+        if (m[1]) {
+            auto q = m[1];
+            for (int i = 1; i < 64; i <<= 1) {
+                q ^= q << i;
+            }
+            inside ^= q;
+            quoted = inside >> 63;
+        }
+        auto lines = m[2] & ~inside;
+        for (auto b = (m[0] | m[2]) & ~inside; b; b &= b - 1) {
+            auto i = __builtin_ctzll(b);
+            separators[count++] = (indexed + i) * 2 + (lines >> i & 1);
+        }
+    }
+    separators.resize(count);
+    return true;
+}
+
+std::string_view CsvReader::Field(const char* p, const char* e, bool last)
+{
+    std::string_view v(p, e - p);
+    if (last && !v.empty() && v.back() == '\r') {
+        v.remove_suffix(1);
+    }
+    if (v.size() >= 2 && v.front() == '"' && v.back() == '"') {
+        v = v.substr(1, v.size() - 2);
+    }
+    return v;
+}
+
+template <typename T>
+bool CsvReader::Convert(std::string_view field, std::vector<T>& column)
+{
+    if constexpr (std::is_same_v<T, std::string_view>) {
+        column.push_back(field);
+        return true;
+    } else {
+        Parser p(field);
+        T v;
+        if (p.Number(v) && !p.More()) {
+            column.push_back(v);
+            return true;
+        }
+        return false;
+    }
+}
+
+template <typename F>
+auto ParseCsvParallel(std::string_view text, F f, size_t chunks, char delim)
+    -> std::vector<std::invoke_result_t<F, CsvReader&>>
+{
+    return ParseParallel(
+        text,
+        [&](Parser& p) {
+            CsvReader r(p.Tail(), delim);
+            return f(r);
+        },
+        chunks);
+}
+
+#endif
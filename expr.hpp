@@ -0,0 +1,353 @@
+#ifndef EXPR_HPP
+#define EXPR_HPP
+
+#include <cmath>
+
+#include "walker.hpp"
+
+// Arithmetic expression compiled once to postfix code, for evaluating
+// the same formula with many values of its variables.
+//
+//   Expr e;
+//   e.Compile("price * (1 - discount) + 2.5", { "price", "discount" });
+//   double values[] = { 10, 0.2 };
+//   e.Eval(values); // 10.5
+//
+// Supports numbers, variables, parentheses, unary minus and the binary
+// operators + - * /, which associate to the left. Operations on
+// constants only are done when compiling.
+class Expr {
+public:
+    // Compiles the text. The n-th name of vars refers to the n-th value
+    // of each evaluation. The text may nest at most 256 levels.
+    bool Compile(std::string_view text, const std::vector<std::string_view>& vars = {});
+    // Returns where the compilation failed.
+    Location Error() const;
+    // Returns the number of variables.
+    size_t Vars() const;
+
+    // Evaluates with the values of the variables.
+    // Returns NaN if nothing is compiled.
+    double Eval(const double* vars) const;
+    // Evaluates n bindings stored one after another, Vars() values each.
+    void Eval(const double* rows, size_t n, double* out) const;
+    // Evaluates n bindings stored as one array of n values per variable.
+    // Runs each operation over blocks of bindings, which the compiler
+    // can vectorize.
+    void Eval(const double* const* columns, size_t n, double* out) const;
+
+private:
+    enum Op : uint8_t {
+        Const,
+        Var,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Neg,
+    };
+
+    struct Code {
+        Op op;
+        // Index of the constant or variable.
+        uint32_t arg;
+    };
+
+    static constexpr size_t maxDepth = 256;
+    // Each level of nesting leaves at most two operands on the stack,
+    // and the innermost level three.
+    static constexpr size_t maxStack = 2 * maxDepth + 3;
+    static constexpr size_t block = 64;
+
+    bool Sum(Parser& p, size_t depth);
+    bool Product(Parser& p, size_t depth);
+    bool Unary(Parser& p, size_t depth);
+    bool Atom(Parser& p, size_t depth);
+    // Appends an operation, or folds it into the constants before it.
+    void Emit(Op op, uint32_t arg = 0);
+    static double Apply(Op op, double a, double b);
+
+    std::vector<Code> code;
+    std::vector<double> constants;
+    std::vector<std::string_view> names;
+    // Values on the stack after the code so far, and at most.
+    size_t height = 0;
+    size_t peak = 0;
+    Location error = { 0, 0 };
+};
+
+bool Expr::Compile(std::string_view text, const std::vector<std::string_view>& vars)
+{
+    code.clear();
+    constants.clear();
+    names = vars;
+    height = peak = 0;
+    error = { 0, 0 };
+    Parser p(text);
+    if (Sum(p, 0)) {
+        p.Space();
+        if (p.More()) {
+            p.Fail("operator");
+        } else if (peak > maxStack) {
+            p.Fail("less nesting");
+        } else {
+            return true;
+        }
+    }
+    error = p.Locate(p.Failure());
+    code.clear();
+    return false;
+}
+
+Location Expr::Error() const
+{
+    return error;
+}
+
+size_t Expr::Vars() const
+{
+    return names.size();
+}
+
+double Expr::Eval(const double* vars) const
+{
+    if (code.empty()) {
+        return NAN;
+    }
+    // Compile rejects code that needs more.
+    double stack[maxStack];
+    size_t top = 0;
+    for (auto c : code) {
+        switch (c.op) {
+        case Const:
+            stack[top++] = constants[c.arg];
+            break;
+        case Var:
+            stack[top++] = vars[c.arg];
+            break;
+        case Add:
+            top--;
+            stack[top - 1] += stack[top];
+            break;
+        case Sub:
+            top--;
+            stack[top - 1] -= stack[top];
+            break;
+        case Mul:
+            top--;
+            stack[top - 1] *= stack[top];
+            break;
+        case Div:
+            top--;
+            stack[top - 1] /= stack[top];
+            break;
+        case Neg:
+            stack[top - 1] = -stack[top - 1];
+            break;
+        }
+    }
+    return stack[0];
+}
+
+void Expr::Eval(const double* rows, size_t n, double* out) const
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = Eval(rows + i * names.size());
+    }
+}
+
+void Expr::Eval(const double* const* columns, size_t n, double* out) const
+{
+    if (code.empty()) {
+        std::fill(out, out + n, NAN);
+        return;
+    }
+    // One block of values per stack entry.
+    std::vector<double> stack(peak * block);
+    for (size_t i = 0; i < n; i += block) {
+        auto m = std::min(block, n - i);
+        double* top = nullptr;
+        for (auto c : code) {
+            switch (c.op) {
+            case Const:
+                top = top ? top + block : stack.data();
+                std::fill(top, top + m, constants[c.arg]);
+                break;
+            case Var:
+                top = top ? top + block : stack.data();
+                std::copy(columns[c.arg] + i, columns[c.arg] + i + m, top);
+                break;
+            case Add:
+                top -= block;
+                for (size_t j = 0; j < m; j++) {
+                    top[j] += top[j + block];
+                }
+                break;
+            case Sub:
+                top -= block;
+                for (size_t j = 0; j < m; j++) {
+                    top[j] -= top[j + block];
+                }
+                break;
+            case Mul:
+                top -= block;
+                for (size_t j = 0; j < m; j++) {
+                    top[j] *= top[j + block];
+                }
+                break;
+            case Div:
+                top -= block;
+                for (size_t j = 0; j < m; j++) {
+                    top[j] /= top[j + block];
+                }
+                break;
+            case Neg:
+                for (size_t j = 0; j < m; j++) {
+                    top[j] = -top[j];
+                }
+                break;
+            }
+        }
+        std::copy(top, top + m, out + i);
+    }
+}
+
+bool Expr::Sum(Parser& p, size_t depth)
+{
+    if (!Product(p, depth)) {
+        return false;
+    }
+    for (;;) {
+        p.Space();
+        if (p.Match('+')) {
+            if (!Product(p, depth)) {
+                return false;
+            }
+            Emit(Add);
+        } else if (p.Match('-')) {
+            if (!Product(p, depth)) {
+                return false;
+            }
+            Emit(Sub);
+        } else {
+            return true;
+        }
+    }
+}
+
+bool Expr::Product(Parser& p, size_t depth)
+{
+    if (!Unary(p, depth)) {
+        return false;
+    }
+    for (;;) {
+        p.Space();
+        if (p.Match('*')) {
+            if (!Unary(p, depth)) {
+                return false;
+            }
+            Emit(Mul);
+        } else if (p.Match('/')) {
+            if (!Unary(p, depth)) {
+                return false;
+            }
+            Emit(Div);
+        } else {
+            return true;
+        }
+    }
+}
+
+bool Expr::Unary(Parser& p, size_t depth)
+{
+    p.Space();
+    if (p.Match('-')) {
+        if (depth >= maxDepth) {
+            return p.Fail("less nesting");
+        }
+        if (!Unary(p, depth + 1)) {
+            return false;
+        }
+        Emit(Neg);
+        return true;
+    }
+    return Atom(p, depth);
+}
+
+bool Expr::Atom(Parser& p, size_t depth)
+{
+    static constexpr CharSet first("a-zA-Z_");
+    static constexpr CharSet rest("a-zA-Z0-9_");
+    if (p.Match('(')) {
+        if (depth >= maxDepth) {
+            return p.Fail("less nesting");
+        }
+        if (!Sum(p, depth + 1)) {
+            return false;
+        }
+        p.Space();
+        return p.Match(')') || p.Fail("')'");
+    }
+    auto m = p.Mark();
+    if (p.Match(first)) {
+        p.While(rest);
+        auto name = p.Token(m);
+        for (size_t i = 0; i < names.size(); i++) {
+            if (names[i] == name) {
+                Emit(Var, i);
+                return true;
+            }
+        }
+        p.Back(m);
+        return p.Fail("variable");
+    }
+    double v;
+    if (p.Number(v)) {
+        constants.push_back(v);
+        Emit(Const, constants.size() - 1);
+        return true;
+    }
+    return p.Fail("value");
+}
+
+void Expr::Emit(Op op, uint32_t arg)
+{
+    auto n = code.size();
+    if (op == Neg && n >= 1 && code[n - 1].op == Const) {
+        auto& c = constants[code[n - 1].arg];
+        c = -c;
+        return;
+    }
+    if (op >= Add && op <= Div && n >= 2 && code[n - 1].op == Const && code[n - 2].op == Const) {
+        auto& a = constants[code[n - 2].arg];
+        a = Apply(op, a, constants[code[n - 1].arg]);
+        constants.pop_back();
+        code.pop_back();
+        height--;
+        return;
+    }
+    code.push_back({ op, arg });
+    if (op == Const || op == Var) {
+        peak = std::max(peak, ++height);
+    } else if (op != Neg) {
+        height--;
+    }
+}
+
+double Expr::Apply(Op op, double a, double b)
+{
+    switch (op) {
+    case Add:
+        return a + b;
+    case Sub:
+        return a - b;
+    case Mul:
+        return a * b;
+    case Div:
+        return a / b;
+    default:
+        return a;
+    }
+}
+
+#endif
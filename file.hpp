@@ -0,0 +1,152 @@
+#ifndef FILE_HPP
+#define FILE_HPP
+
+#include "walker.hpp"
+
+#ifdef _WIN32
+#include <fstream>
+#include <sstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file.
+// On POSIX systems the file is memory mapped, so tokens point straight
+// into the page cache instead of into a copy of the file.
+// Elsewhere the file is read into memory.
+class MappedFile {
+public:
+    // Maps the file at path. Asks for huge pages if hugePages is true,
+    // which the system may ignore.
+    MappedFile(const std::string& path, bool hugePages = false);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    // Tells if the file was opened.
+    bool Ok();
+    // Returns the contents of the file.
+    std::string_view Text();
+
+private:
+    bool ok = false;
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    std::string buf;
+#endif
+};
+
+// Text parser over a memory mapped file.
+// Tokens remain valid while the parser exists.
+class MappedParser : private MappedFile, public Parser {
+public:
+    MappedParser(const std::string& path, bool hugePages = false);
+
+    using MappedFile::Ok;
+};
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path, bool)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (in) {
+        std::ostringstream s;
+        s << in.rdbuf();
+        buf = s.str();
+        size = buf.size();
+#ifdef WALKER_PADDED
+        buf.append(PaddedString::padding, '\0');
+#endif
+        data = buf.data();
+        ok = true;
+    }
+}
+
+MappedFile::~MappedFile()
+{
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path, bool hugePages)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        size = st.st_size;
+        // An empty file cannot be mapped, but it is a valid empty text.
+        ok = size == 0;
+        if (size > 0) {
+#ifdef WALKER_PADDED
+            // Maps zeros for the padding, then the file over their start.
+            void* p = mmap(nullptr, size + PaddedString::padding, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED && mmap(p, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                munmap(p, size + PaddedString::padding);
+                p = MAP_FAILED;
+            }
+#else
+            void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+#endif
+            if (p != MAP_FAILED) {
+                madvise(p, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+                if (hugePages) {
+                    madvise(p, size, MADV_HUGEPAGE);
+                }
+#endif
+                data = (const char*)p;
+                ok = true;
+            }
+        }
+    }
+    close(fd);
+    if (!ok) {
+        size = 0;
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (data) {
+#ifdef WALKER_PADDED
+        munmap((void*)data, size + PaddedString::padding);
+#else
+        munmap((void*)data, size);
+#endif
+    }
+}
+
+#endif
+
+bool MappedFile::Ok()
+{
+    return ok;
+}
+
+std::string_view MappedFile::Text()
+{
+#ifdef WALKER_PADDED
+    // An empty file has no mapping to pad.
+    static const PaddedString empty;
+    if (!data) {
+        return empty;
+    }
+#endif
+    return std::string_view(data, size);
+}
+
+MappedParser::MappedParser(const std::string& path, bool hugePages)
+    : MappedFile(path, hugePages)
+    , Parser(Text())
+{
+}
+
+#endif
@@ -0,0 +1,648 @@
+#ifndef GRAMMAR_HPP
+#define GRAMMAR_HPP
+
+#include <array>
+#include <bitset>
+#include <memory>
+#include <type_traits>
+
+#include "walker.hpp"
+
+// Grammars composed at compile time from the parser primitives.
+//
+//   a >> b    matches a then b, rewinding if b fails
+//   a | b     matches a, or else b
+//   *a        matches a zero or more times
+//   +a        matches a one or more times
+//   -a        matches a optionally
+//   !a        tests that a does not match, without advancing
+//
+// Characters and strings in an expression match themselves.
+// Each expression has its own type, so the compiler can inline a whole
+// grammar into the function that runs it. Recursive grammars go through
+// a Rule, which costs one indirect call.
+// Each expression also knows the characters it can start with, so a
+// choice looks up the next character in a table and only tries the
+// alternatives that can match there. Grammars whose alternatives start
+// differently are predictive and never rewind.
+//
+//   grammar::Rule value;
+//   auto list = '[' >> -(value >> *(',' >> value)) >> ']';
+//   value = grammar::Integer() | list;
+//   value(p);
+namespace grammar {
+
+// Characters a match can start with, and whether it can match
+// without consuming any.
+struct FirstSet {
+    std::bitset<256> chars;
+    bool empty = false;
+
+    // Any character, or nothing, for matches that are not known.
+    static FirstSet Any();
+    // Characters in the range, compared as Parser::Match does.
+    static FirstSet In(char lo, char hi);
+    bool Has(char c) const;
+};
+
+// Base of every grammar expression.
+struct Node {
+    FirstSet First() const;
+};
+
+template <typename T>
+concept Grammar = std::is_base_of_v<Node, std::remove_cvref_t<T>>;
+
+// Types that can appear in an expression.
+template <typename T>
+concept Operand = Grammar<T> || std::is_same_v<std::remove_cvref_t<T>, char> || std::is_convertible_v<T, std::string_view>;
+
+// Handle to a grammar that can be defined after it is used,
+// which makes recursive grammars possible.
+// Expressions refer to the rule, so it must outlive them.
+// Choices see a rule before it is defined, so a rule can start with
+// anything unless it is declared with the characters its grammar starts
+// with, which must include every one it can match at.
+class Rule : public Node {
+public:
+    Rule() = default;
+    explicit Rule(FirstSet first);
+    Rule(const Rule&) = delete;
+    Rule& operator=(const Rule&) = delete;
+
+    // Defines the rule. Allocates once to keep the grammar.
+    template <Grammar G>
+    Rule& operator=(G g);
+    // Runs the rule. Fails if it is not defined.
+    bool operator()(Parser& p) const;
+    FirstSet First() const;
+
+private:
+    std::unique_ptr<void, void (*)(void*)> body { nullptr, nullptr };
+    bool (*run)(const void*, Parser&) = nullptr;
+    FirstSet first = FirstSet::Any();
+};
+
+// A use of a rule in an expression.
+struct RuleRef : Node {
+    const Rule* rule;
+    bool operator()(Parser& p) const;
+    FirstSet First() const;
+};
+
+// Matches with a function that takes the parser.
+template <typename F>
+struct Primitive : Node {
+    F f;
+    FirstSet first = FirstSet::Any();
+    bool operator()(Parser& p) const;
+    FirstSet First() const;
+};
+
+template <typename A, typename B>
+struct Sequence : Node {
+    A a;
+    B b;
+    bool operator()(Parser& p) const;
+    FirstSet First() const;
+};
+
+// Tries only the alternatives that can start with the next character.
+// Tries both when neither can, so failures are recorded as usual, and
+// always with WALKER_EXPECTED, so every expectation is listed.
+template <typename A, typename B>
+struct Choice : Node {
+    A a;
+    B b;
+    // Whether a (bit 0) and b (bit 1) can match at each character,
+    // and at the end of the text.
+    std::array<uint8_t, 257> viable = {};
+    bool operator()(Parser& p) const;
+    FirstSet First() const;
+    void Index();
+};
+
+// Stops at the first match that does not advance the parser,
+// so rules that match empty text do not loop forever.
+template <typename A, bool Once>
+struct Repeat : Node {
+    A a;
+    bool operator()(Parser& p) const;
+    FirstSet First() const;
+};
+
+template <typename A>
+struct Optional : Node {
+    A a;
+    bool operator()(Parser& p) const;
+    FirstSet First() const;
+};
+
+template <typename A>
+struct Absent : Node {
+    A a;
+    bool operator()(Parser& p) const;
+};
+
+template <typename A, typename Out>
+struct Output : Node {
+    A a;
+    Out* out;
+    bool operator()(Parser& p) const;
+    FirstSet First() const;
+};
+
+template <typename A>
+struct OutputTokens : Node {
+    A a;
+    Tokens* out;
+    uint8_t kind;
+    bool operator()(Parser& p) const;
+    FirstSet First() const;
+};
+
+template <typename A, typename F>
+struct Callback : Node {
+    A a;
+    F f;
+    bool operator()(Parser& p) const;
+    FirstSet First() const;
+};
+
+template <typename A>
+struct Profiled : Node {
+    A a;
+    std::string_view name;
+    bool operator()(Parser& p) const;
+    FirstSet First() const;
+};
+
+// Returns the expression for an operand.
+// Rules are referred to, characters and strings become matches.
+template <Operand T>
+auto Lift(T&& v);
+
+// Matches with f(p), for any parser call not covered below.
+template <typename F>
+Primitive<F> Fn(F f);
+// Matches with f(p), which only matches text that starts with one of
+// the characters of first, or no text if first is empty.
+template <typename F>
+Primitive<F> Fn(F f, FirstSet first);
+// Matches the given character.
+auto Ch(char c);
+// Matches a character in the given range.
+auto In(char lo, char hi);
+// Matches a character in the set. Keeps a copy of the set.
+auto In(const CharSet& set);
+// Matches the given string, which must outlive the expression.
+auto Str(std::string_view v);
+// Matches the patterns, which must outlive the expression.
+auto Str(const Patterns& set);
+// Matches whitespace characters, or nothing.
+auto Space();
+// Matches a string enclosed in quotes.
+auto String(char quote);
+// Matches an integer number.
+auto Integer();
+// Matches a float number.
+auto Float();
+// Matches a number and outputs it.
+template <typename T>
+auto Number(T& out);
+
+// Outputs the token matched by a, as Parser::Out does.
+template <Operand A, typename Out>
+auto Capture(A&& a, Out& out);
+// Appends the token matched by a to the token array.
+template <Operand A>
+auto Capture(A&& a, Tokens& out, uint8_t kind);
+// Calls f with the token matched by a. If f returns a bool,
+// false fails the match and rewinds the parser.
+template <Operand A, typename F>
+auto Action(A&& a, F f);
+// Counts the matches of a under the name, as Parser::Profile does.
+template <Operand A>
+auto Profile(A&& a, std::string_view name);
+
+template <Operand A, Operand B>
+    requires(Grammar<A> || Grammar<B>)
+auto operator>>(A&& a, B&& b);
+template <Operand A, Operand B>
+    requires(Grammar<A> || Grammar<B>)
+auto operator|(A&& a, B&& b);
+template <Grammar A>
+auto operator*(A&& a);
+template <Grammar A>
+auto operator+(A&& a);
+template <Grammar A>
+auto operator-(A&& a);
+template <Grammar A>
+auto operator!(A&& a);
+
+FirstSet FirstSet::Any()
+{
+    FirstSet s;
+    s.chars.set();
+    s.empty = true;
+    return s;
+}
+
+FirstSet FirstSet::In(char lo, char hi)
+{
+    FirstSet s;
+    for (int c = 0; c < 256; c++) {
+        s.chars[c] = char(c) >= lo && char(c) <= hi;
+    }
+    return s;
+}
+
+bool FirstSet::Has(char c) const
+{
+    return chars[(unsigned char)c];
+}
+
+FirstSet Node::First() const
+{
+    return FirstSet::Any();
+}
+
+Rule::Rule(FirstSet first)
+    : first(first)
+{
+}
+
+template <Grammar G>
+Rule& Rule::operator=(G g)
+{
+    body = { new G(std::move(g)), [](void* g) { delete (G*)g; } };
+    run = [](const void* g, Parser& p) { return (*(const G*)g)(p); };
+    return *this;
+}
+
+bool Rule::operator()(Parser& p) const
+{
+    return run && run(body.get(), p);
+}
+
+FirstSet Rule::First() const
+{
+    return first;
+}
+
+bool RuleRef::operator()(Parser& p) const
+{
+    return (*rule)(p);
+}
+
+FirstSet RuleRef::First() const
+{
+    return rule->First();
+}
+
+template <typename F>
+bool Primitive<F>::operator()(Parser& p) const
+{
+    return f(p);
+}
+
+template <typename F>
+FirstSet Primitive<F>::First() const
+{
+    return first;
+}
+
+template <typename A, typename B>
+bool Sequence<A, B>::operator()(Parser& p) const
+{
+    auto m = p.Mark();
+    return p.Undo(m, a(p) && b(p));
+}
+
+template <typename A, typename B>
+FirstSet Sequence<A, B>::First() const
+{
+    auto s = a.First();
+    if (s.empty) {
+        auto t = b.First();
+        s.chars |= t.chars;
+        s.empty = t.empty;
+    }
+    return s;
+}
+
+template <typename A, typename B>
+bool Choice<A, B>::operator()(Parser& p) const
+{
+#ifndef WALKER_EXPECTED
+    switch (viable[p.More() ? (unsigned char)p.Curr() : 256]) {
+    case 1:
+        return a(p);
+    case 2:
+        return b(p);
+    }
+#endif
+    return a(p) || b(p);
+}
+
+template <typename A, typename B>
+FirstSet Choice<A, B>::First() const
+{
+    auto s = a.First();
+    auto t = b.First();
+    s.chars |= t.chars;
+    s.empty |= t.empty;
+    return s;
+}
+
+template <typename A, typename B>
+void Choice<A, B>::Index()
+{
+    auto s = a.First();
+    auto t = b.First();
+    for (int c = 0; c < 256; c++) {
+        viable[c] = (s.empty || s.chars[c]) | (t.empty || t.chars[c]) << 1;
+    }
+    viable[256] = s.empty | t.empty << 1;
+}
+
+template <typename A, bool Once>
+bool Repeat<A, Once>::operator()(Parser& p) const
+{
+    if (Once && !a(p)) {
+        return false;
+    }
+    for (;;) {
+        auto m = p.Mark();
+        if (!a(p) || !p.Moved(m)) {
+            return true;
+        }
+    }
+}
+
+template <typename A, bool Once>
+FirstSet Repeat<A, Once>::First() const
+{
+    auto s = a.First();
+    s.empty |= !Once;
+    return s;
+}
+
+template <typename A>
+bool Optional<A>::operator()(Parser& p) const
+{
+    a(p);
+    return true;
+}
+
+template <typename A>
+FirstSet Optional<A>::First() const
+{
+    auto s = a.First();
+    s.empty = true;
+    return s;
+}
+
+template <typename A>
+bool Absent<A>::operator()(Parser& p) const
+{
+    auto m = p.Mark();
+    return !p.Peek(m, a(p));
+}
+
+template <typename A, typename Out>
+bool Output<A, Out>::operator()(Parser& p) const
+{
+    auto m = p.Mark();
+    return p.Out(m, a(p), *out);
+}
+
+template <typename A, typename Out>
+FirstSet Output<A, Out>::First() const
+{
+    return a.First();
+}
+
+template <typename A>
+bool OutputTokens<A>::operator()(Parser& p) const
+{
+    auto m = p.Mark();
+    return p.Out(m, a(p), *out, kind);
+}
+
+template <typename A>
+FirstSet OutputTokens<A>::First() const
+{
+    return a.First();
+}
+
+template <typename A, typename F>
+bool Callback<A, F>::operator()(Parser& p) const
+{
+    auto m = p.Mark();
+    if (!a(p)) {
+        return false;
+    }
+    if constexpr (std::is_same_v<std::invoke_result_t<const F&, std::string_view>, bool>) {
+        return p.Undo(m, f(p.Token(m)));
+    } else {
+        f(p.Token(m));
+        return true;
+    }
+}
+
+template <typename A, typename F>
+FirstSet Callback<A, F>::First() const
+{
+    return a.First();
+}
+
+template <typename A>
+bool Profiled<A>::operator()(Parser& p) const
+{
+    return p.Profile(name, [&] { return a(p); });
+}
+
+template <typename A>
+FirstSet Profiled<A>::First() const
+{
+    return a.First();
+}
+
+template <Operand T>
+auto Lift(T&& v)
+{
+    using V = std::remove_cvref_t<T>;
+    if constexpr (std::is_same_v<V, Rule>) {
+        return RuleRef { {}, &v };
+    } else if constexpr (Grammar<V>) {
+        return V(std::forward<T>(v));
+    } else if constexpr (std::is_same_v<V, char>) {
+        return Ch(v);
+    } else {
+        return Str(v);
+    }
+}
+
+template <typename F>
+Primitive<F> Fn(F f)
+{
+    return { {}, std::move(f) };
+}
+
+template <typename F>
+Primitive<F> Fn(F f, FirstSet first)
+{
+    return { {}, std::move(f), first };
+}
+
+auto Ch(char c)
+{
+    return Fn([c](Parser& p) { return p.Match(c); }, FirstSet::In(c, c));
+}
+
+auto In(char lo, char hi)
+{
+    return Fn([lo, hi](Parser& p) { return p.Match({ lo, hi }); }, FirstSet::In(lo, hi));
+}
+
+auto In(const CharSet& set)
+{
+    FirstSet first;
+    for (int c = 0; c < 256; c++) {
+        first.chars[c] = set.Has(char(c));
+    }
+    return Fn([set](Parser& p) { return p.Match(set); }, first);
+}
+
+auto Str(std::string_view v)
+{
+    auto first = v.empty() ? FirstSet::Any() : FirstSet::In(v[0], v[0]);
+    return Fn([v](Parser& p) { return p.Match(v); }, first);
+}
+
+auto Str(const Patterns& set)
+{
+    FirstSet first;
+    for (int c = 0; c < 256; c++) {
+        first.chars[c] = set.Starts(char(c));
+    }
+    return Fn([&set](Parser& p) { return p.Match(set); }, first);
+}
+
+auto Space()
+{
+    return Fn([](Parser& p) { return p.Space() || true; });
+}
+
+auto String(char quote)
+{
+    return Fn([quote](Parser& p) { return p.String(quote); }, FirstSet::In(quote, quote));
+}
+
+// Returns the digits and the other characters a number can start with.
+FirstSet Digits(std::string_view others)
+{
+    auto first = FirstSet::In('0', '9');
+    for (auto c : others) {
+        first.chars[(unsigned char)c] = true;
+    }
+    return first;
+}
+
+auto Integer()
+{
+    return Fn([](Parser& p) { return p.Integer(); }, Digits("+-"));
+}
+
+// Parser::Float also matches an exponent alone.
+auto Float()
+{
+    return Fn([](Parser& p) { return p.Float(); }, Digits("+-.eE"));
+}
+
+template <typename T>
+auto Number(T& out)
+{
+    return Fn([&out](Parser& p) { return p.Number(out); }, Digits(std::is_integral_v<T> ? "+-" : "+-."));
+}
+
+template <Operand A, typename Out>
+auto Capture(A&& a, Out& out)
+{
+    using L = decltype(Lift(std::forward<A>(a)));
+    return Output<L, Out> { {}, Lift(std::forward<A>(a)), &out };
+}
+
+template <Operand A>
+auto Capture(A&& a, Tokens& out, uint8_t kind)
+{
+    using L = decltype(Lift(std::forward<A>(a)));
+    return OutputTokens<L> { {}, Lift(std::forward<A>(a)), &out, kind };
+}
+
+template <Operand A, typename F>
+auto Action(A&& a, F f)
+{
+    using L = decltype(Lift(std::forward<A>(a)));
+    return Callback<L, F> { {}, Lift(std::forward<A>(a)), std::move(f) };
+}
+
+template <Operand A>
+auto Profile(A&& a, std::string_view name)
+{
+    using L = decltype(Lift(std::forward<A>(a)));
+    return Profiled<L> { {}, Lift(std::forward<A>(a)), name };
+}
+
+template <Operand A, Operand B>
+    requires(Grammar<A> || Grammar<B>)
+auto operator>>(A&& a, B&& b)
+{
+    using L = decltype(Lift(std::forward<A>(a)));
+    using R = decltype(Lift(std::forward<B>(b)));
+    return Sequence<L, R> { {}, Lift(std::forward<A>(a)), Lift(std::forward<B>(b)) };
+}
+
+template <Operand A, Operand B>
+    requires(Grammar<A> || Grammar<B>)
+auto operator|(A&& a, B&& b)
+{
+    using L = decltype(Lift(std::forward<A>(a)));
+    using R = decltype(Lift(std::forward<B>(b)));
+    Choice<L, R> c { {}, Lift(std::forward<A>(a)), Lift(std::forward<B>(b)) };
+    c.Index();
+    return c;
+}
+
+template <Grammar A>
+auto operator*(A&& a)
+{
+    using L = decltype(Lift(std::forward<A>(a)));
+    return Repeat<L, false> { {}, Lift(std::forward<A>(a)) };
+}
+
+template <Grammar A>
+auto operator+(A&& a)
+{
+    using L = decltype(Lift(std::forward<A>(a)));
+    return Repeat<L, true> { {}, Lift(std::forward<A>(a)) };
+}
+
+template <Grammar A>
+auto operator-(A&& a)
+{
+    using L = decltype(Lift(std::forward<A>(a)));
+    return Optional<L> { {}, Lift(std::forward<A>(a)) };
+}
+
+template <Grammar A>
+auto operator!(A&& a)
+{
+    using L = decltype(Lift(std::forward<A>(a)));
+    return Absent<L> { {}, Lift(std::forward<A>(a)) };
+}
+
+}
+
+#endif
@@ -0,0 +1,946 @@
+#ifndef JSON_HPP
+#define JSON_HPP
+
+#include <algorithm>
+
+#include "walker.hpp"
+
+enum class JsonType : uint8_t {
+    Null,
+    Bool,
+    Number,
+    String,
+    Array,
+    Object,
+};
+
+class Json;
+
+// A value in a parsed JSON document. Cheap to copy.
+// Valid while the document exists and is not parsed again.
+class JsonValue {
+public:
+    JsonValue() = default;
+
+    // Tells if the value exists. Missing members and elements,
+    // and the values past the last one, do not.
+    bool Ok() const;
+    JsonType Type() const;
+    // Outputs the value if it has the type of out.
+    // Integers fail if the number has a fraction, an exponent
+    // or is out of the range of out.
+    bool Get(bool& out) const;
+    bool Get(double& out) const;
+    bool Get(int64_t& out) const;
+    bool Get(uint64_t& out) const;
+    // Outputs a string with its escapes replaced.
+    bool Get(std::string& out) const;
+    // Outputs a string with its escapes replaced, without copying it
+    // if it has none. Strings without escapes are views of the input.
+    // The others are unescaped into storage, which out then views.
+    bool Get(std::string_view& out, std::string& storage) const;
+    // Returns the text of a string (without quotes) or of a number
+    // as it is in the input.
+    std::string_view Raw() const;
+    // Returns the number of elements or members.
+    size_t Size() const;
+    // Returns the element with the given index.
+    JsonValue operator[](size_t i) const;
+    // Returns the member with the given key.
+    JsonValue operator[](std::string_view key) const;
+    // Returns the first element or member.
+    JsonValue First() const;
+    // Returns the next element or member of the same array or object.
+    JsonValue Next() const;
+    // Returns the key of a member, with its escapes replaced.
+    // Keys with escapes are unescaped into storage, as Get does.
+    std::string_view Key(std::string& storage) const;
+
+private:
+    friend class Json;
+    JsonValue(const Json* doc, uint32_t index, uint32_t stop, bool member);
+
+    const Json* doc = nullptr;
+    uint32_t index = 0;
+    // Index past the values of the container of the value.
+    uint32_t stop = 0;
+    // Tells if the value is the member of an object.
+    bool member = false;
+};
+
+// JSON document parser.
+// Parsing runs in two stages. The first finds the quotes and the
+// brackets, colons and commas outside strings, 64 characters at a time,
+// and stores their offsets in an index. The second walks the index to
+// validate the text and build the tape, reading only the strings and
+// the numbers and literals between the offsets.
+// Values are stored in one array (a tape) in the order they appear,
+// each container followed by its contents, so parsing allocates
+// nothing once the arrays have grown to fit the document.
+// Strings and numbers are views of the input, which must outlive
+// the document. Strings with escapes are unescaped when read, into
+// storage given by the caller, so a document can be read from many
+// threads at once.
+class Json {
+public:
+    // Parses and validates the text as defined by RFC 8259, including
+    // the UTF-8 of strings and the pairing of surrogate escapes.
+    // The text must be smaller than 4 GiB and nest at most 1024 levels.
+    // Reuses the memory of the previous document.
+    bool Parse(std::string_view text);
+    // Returns the top level value.
+    JsonValue Root() const;
+    // Returns where the parsing failed.
+    Location Error() const;
+
+private:
+    friend class JsonValue;
+    friend class JsonCursor;
+
+    struct Node {
+        JsonType type;
+        // The value of a bool, whether a string has escapes
+        // or whether a number is an integer.
+        bool flag;
+        // Number of elements or members, or length of the text.
+        uint32_t size;
+        // Offset of the text of a string or number.
+        uint32_t offset;
+        // Index past the contents of the value.
+        uint32_t end;
+    };
+
+    // Stores the offsets of the structural characters in index,
+    // followed by the size of the text.
+    void Index();
+    // Reads the value at pos and the index entries it spans.
+    bool Value(int depth);
+    bool Container(int depth, JsonType type, char close);
+    bool String();
+    bool Scalar(uint32_t start, uint32_t stop);
+    // Returns the first character from start to stop that is not
+    // whitespace, or stop.
+    uint32_t Blank(uint32_t start, uint32_t stop) const;
+    // Records the offset where the parsing failed.
+    bool Fail(uint32_t offset);
+    // Advances q past a number. Tells if it is valid and outputs
+    // whether it is an integer.
+    static bool Number(const char*& q, const char* e, bool& integer);
+    // Reads the escape after a backslash. A \u escape of a high
+    // surrogate must be followed by one of a low surrogate.
+    static bool Escape(Parser& p);
+    // Reads the four hex digits of a \u escape.
+    static bool Hex(Parser& p, uint32_t& code);
+    static void Space(Parser& p);
+    std::string_view Text(uint32_t index, std::string& storage) const;
+
+    std::string_view text;
+    std::vector<Node> nodes;
+    Location error = { 0, 0 };
+    // Offsets of the structural characters, followed by the size of
+    // the text. Only grows, so it fits a text of its size at least.
+    std::vector<uint32_t> index;
+    // The next index entry and the offset past the last value read.
+    const uint32_t* at = nullptr;
+    uint32_t pos = 0;
+    // Offsets of the next backslash and control character in the text.
+    uint32_t backslash = 0;
+    uint32_t control = 0;
+    uint32_t failure = 0;
+};
+
+// Lazy view of a JSON value in a text, for reading a few values
+// without parsing the whole document.
+// Looking up a member or element skips the values before it, so only
+// the text up to the value is read. Skipped arrays and objects are
+// checked for matching quotes and brackets only; strings, numbers and
+// literals are checked with the grammar of Json.
+// Valid while the text exists.
+class JsonCursor {
+public:
+    JsonCursor() = default;
+    // Points to the top level value of the text.
+    JsonCursor(std::string_view text);
+
+    // Tells if the value exists.
+    bool Ok() const;
+    // Returns the type of the value, as told by its first character.
+    JsonType Type() const;
+    // Outputs the value if it is a bool or a number in the range of out.
+    bool Get(bool& out) const;
+    bool Get(double& out) const;
+    bool Get(int64_t& out) const;
+    bool Get(uint64_t& out) const;
+    // Outputs a string with its escapes replaced.
+    bool Get(std::string& out) const;
+    // Returns the text of the value, without quotes for a string.
+    std::string_view Raw() const;
+    // Returns the element with the given index.
+    JsonCursor operator[](size_t i) const;
+    // Returns the member with the given key.
+    JsonCursor operator[](std::string_view key) const;
+
+private:
+    // Returns the value at the current position, if one starts there.
+    static JsonCursor At(Parser& p);
+    // Skips the value at the current position.
+    static bool Skip(Parser& p);
+    // Returns the end of the array or object at p, or nullptr.
+    static const char* Close(const char* p, const char* e);
+    // Opens or closes a bracket of Close. Returns 1 if it closes the
+    // first one, -1 if it does not match the last open one, or 0.
+    static int Bracket(std::string& open, char c);
+
+    // From the value to the end of the text.
+    std::string_view text;
+};
+
+JsonValue::JsonValue(const Json* doc, uint32_t index, uint32_t stop, bool member)
+    : doc(doc)
+    , index(index)
+    , stop(stop)
+    , member(member)
+{
+}
+
+bool JsonValue::Ok() const
+{
+    return doc && index < stop;
+}
+
+JsonType JsonValue::Type() const
+{
+    return Ok() ? doc->nodes[index].type : JsonType::Null;
+}
+
+bool JsonValue::Get(bool& out) const
+{
+    if (Type() != JsonType::Bool) {
+        return false;
+    }
+    out = doc->nodes[index].flag;
+    return true;
+}
+
+bool JsonValue::Get(double& out) const
+{
+    if (Type() != JsonType::Number) {
+        return false;
+    }
+    auto v = Raw();
+    return std::from_chars(v.data(), v.data() + v.size(), out).ec == std::errc();
+}
+
+bool JsonValue::Get(int64_t& out) const
+{
+    if (Type() != JsonType::Number || !doc->nodes[index].flag) {
+        return false;
+    }
+    auto v = Raw();
+    return std::from_chars(v.data(), v.data() + v.size(), out).ec == std::errc();
+}
+
+bool JsonValue::Get(uint64_t& out) const
+{
+    if (Type() != JsonType::Number || !doc->nodes[index].flag) {
+        return false;
+    }
+    auto v = Raw();
+    return std::from_chars(v.data(), v.data() + v.size(), out).ec == std::errc();
+}
+
+bool JsonValue::Get(std::string& out) const
+{
+    std::string_view v;
+    if (!Get(v, out)) {
+        return false;
+    }
+    if (v.data() != out.data()) {
+        out = v;
+    }
+    return true;
+}
+
+bool JsonValue::Get(std::string_view& out, std::string& storage) const
+{
+    if (Type() != JsonType::String) {
+        return false;
+    }
+    out = doc->Text(index, storage);
+    return true;
+}
+
+std::string_view JsonValue::Raw() const
+{
+    auto t = Type();
+    if (t != JsonType::String && t != JsonType::Number) {
+        return {};
+    }
+    auto& n = doc->nodes[index];
+    return doc->text.substr(n.offset, n.size);
+}
+
+size_t JsonValue::Size() const
+{
+    auto t = Type();
+    return t == JsonType::Array || t == JsonType::Object ? doc->nodes[index].size : 0;
+}
+
+JsonValue JsonValue::operator[](size_t i) const
+{
+    auto v = First();
+    for (; i > 0 && v.Ok(); i--) {
+        v = v.Next();
+    }
+    return v;
+}
+
+JsonValue JsonValue::operator[](std::string_view key) const
+{
+    if (Type() != JsonType::Object) {
+        return {};
+    }
+    // Only keys with escapes are unescaped, into one string for all.
+    std::string storage;
+    auto v = First();
+    while (v.Ok() && v.Key(storage) != key) {
+        v = v.Next();
+    }
+    return v;
+}
+
+JsonValue JsonValue::First() const
+{
+    auto t = Type();
+    if (t != JsonType::Array && t != JsonType::Object) {
+        return {};
+    }
+    // Members are stored as a key followed by a value.
+    bool object = t == JsonType::Object;
+    return JsonValue(doc, index + 1 + object, doc->nodes[index].end, object);
+}
+
+JsonValue JsonValue::Next() const
+{
+    if (!Ok()) {
+        return *this;
+    }
+    return JsonValue(doc, std::min(doc->nodes[index].end + member, stop), stop, member);
+}
+
+std::string_view JsonValue::Key(std::string& storage) const
+{
+    return Ok() && member ? doc->Text(index - 1, storage) : std::string_view();
+}
+
+bool Json::Parse(std::string_view text)
+{
+    this->text = text;
+    nodes.clear();
+    error = { 0, 0 };
+    if (text.size() >= UINT32_MAX) {
+        error = { 1, 1 };
+        return false;
+    }
+    Index();
+    at = index.data();
+    pos = 0;
+    backslash = 0;
+    control = 0;
+    uint32_t end = text.size();
+    bool ok = Value(0) && (Blank(pos, *at) == end || Fail(Blank(pos, *at)));
+    // The whole text must be UTF-8, which strings are the only place to
+    // break, as anything else outside them is ASCII or a syntax error.
+    auto bad = scan::FindInvalidUtf8(text.data(), text.data() + end) - text.data();
+    if (ok && bad == end) {
+        return true;
+    }
+    if (ok || bad < failure) {
+        failure = bad;
+    }
+    error = Parser(text).Locate(text.substr(failure));
+    nodes.clear();
+    return false;
+}
+
+JsonValue Json::Root() const
+{
+    return JsonValue(this, 0, nodes.size(), false);
+}
+
+Location Json::Error() const
+{
+    return error;
+}
+
+void Json::Index()
+{
+    // Finds the characters as in "Parsing Gigabytes of JSON per Second"
+    // by Langdale and Lemire. A character is escaped if it follows an
+    // odd run of backslashes, found by adding the runs that start on an
+    // odd bit to the backslashes. The bits of the characters in strings
+    // are found by xoring together the bits of the quotes before them.
+    static constexpr char chars[] = { '"', '\\', '{', '}', '[', ']', ':', ',' };
+    constexpr uint64_t even = 0x5555555555555555;
+    if (index.size() < text.size() + 1) {
+        index.resize(text.size() + 1);
+    }
+    auto out = index.data();
+    // Whether the first character of the next block is escaped, and
+    // all ones if the next block starts in a string.
+    uint64_t escapes = 0;
+    uint64_t string = 0;
+    char buf[64];
+    auto s = text.data();
+    auto e = s + text.size();
+    for (auto p = s; p < e; p += 64) {
+        auto block = p;
+        if (e - p < 64) {
+            std::fill(buf, buf + 64, ' ');
+            std::copy(p, e, buf);
+            block = buf;
+        }
+        uint64_t m[8];
+        scan::Masks(block, chars, 8, m);
+        auto backslashes = m[1] & ~escapes;
+        auto follows = backslashes << 1 | escapes;
+        uint64_t runs;
+        escapes = __builtin_add_overflow(backslashes & ~even & ~follows, backslashes, &runs);
+        auto escaped = (even ^ runs << 1) & follows;
+        auto quotes = m[0] & ~escaped;
+        auto inside = quotes;
+        for (int i = 1; i < 64; i <<= 1) {
+            inside ^= inside << i;
+        }
+        inside ^= string;
+        string = uint64_t(int64_t(inside) >> 63);
+        auto structural = ((m[2] | m[3] | m[4] | m[5] | m[6] | m[7]) & ~inside) | quotes;
+        for (; structural; structural &= structural - 1) {
+            *out++ = uint32_t(p - s + __builtin_ctzll(structural));
+        }
+    }
+    *out = uint32_t(text.size());
+}
+
+bool Json::Value(int depth)
+{
+    auto next = *at;
+    auto start = Blank(pos, next);
+    if (start != next) {
+        return Scalar(start, next);
+    }
+    if (next == text.size()) {
+        return Fail(next);
+    }
+    switch (text[next]) {
+    case '{':
+        return Container(depth, JsonType::Object, '}');
+    case '[':
+        return Container(depth, JsonType::Array, ']');
+    case '"':
+        return String();
+    default:
+        return Fail(next);
+    }
+}
+
+bool Json::Container(int depth, JsonType type, char close)
+{
+    if (depth >= 1024) {
+        return Fail(*at);
+    }
+    auto node = nodes.size();
+    nodes.push_back({ type, false, 0, 0, 0 });
+    uint32_t end = text.size();
+    pos = *at++ + 1;
+    // Returns the character of the next index entry if there is only
+    // whitespace before it, or '\0'.
+    auto next = [&]() {
+        return *at != end && Blank(pos, *at) == *at ? text[*at] : '\0';
+    };
+    uint32_t size = 0;
+    if (next() == close) {
+        pos = *at++ + 1;
+    } else {
+        for (;;) {
+            if (type == JsonType::Object) {
+                if (next() != '"') {
+                    return Fail(Blank(pos, *at));
+                }
+                if (!String()) {
+                    return false;
+                }
+                if (next() != ':') {
+                    return Fail(Blank(pos, *at));
+                }
+                pos = *at++ + 1;
+            }
+            if (!Value(depth + 1)) {
+                return false;
+            }
+            size++;
+            auto c = next();
+            if (c != ',' && c != close) {
+                return Fail(Blank(pos, *at));
+            }
+            pos = *at++ + 1;
+            if (c == close) {
+                break;
+            }
+        }
+    }
+    nodes[node].size = size;
+    nodes[node].end = nodes.size();
+    return true;
+}
+
+bool Json::String()
+{
+    // The closing quote is the next index entry, as the characters
+    // in strings are not indexed. Without one the string runs to the
+    // end of the text, which is checked first for earlier errors.
+    auto start = *at++ + 1;
+    auto stop = *at;
+    // The next backslash and control character are found ahead with
+    // the scan kernels, so strings before them need no checks.
+    auto s = text.data();
+    auto q = s + start;
+    auto e = s + stop;
+    if (backslash < start) {
+        backslash = scan::Find(q, s + text.size(), '\\') - s;
+    }
+    if (control < start) {
+        control = scan::FindIn(q, s + text.size(), '\0', '\x1F') - s;
+    }
+    bool escapes = false;
+    if (backslash < stop || control < stop) {
+        // Escapes are checked up to the first control character, so
+        // the first error is the one reported.
+        auto c = s + std::min(control, stop);
+        for (q = s + backslash; q < c; q = scan::Find(q, c, '\\')) {
+            escapes = true;
+            Parser p(std::string_view(q + 1, e - q - 1));
+            if (!Escape(p)) {
+                return Fail(p.Tail().data() - s);
+            }
+            q = p.Tail().data();
+        }
+        if (control < stop) {
+            return Fail(control);
+        }
+    }
+    if (stop == text.size()) {
+        return Fail(stop);
+    }
+    at++;
+    pos = stop + 1;
+    nodes.push_back({ JsonType::String, escapes, stop - start, start, uint32_t(nodes.size() + 1) });
+    return true;
+}
+
+bool Json::Scalar(uint32_t start, uint32_t stop)
+{
+    auto s = text.data();
+    auto q = s + start;
+    auto e = s + stop;
+    bool ok;
+    bool flag;
+    auto type = JsonType::Bool;
+    auto literal = [&](std::string_view v) {
+        if (text.substr(start, v.size()) != v) {
+            return false;
+        }
+        q += v.size();
+        return true;
+    };
+    switch (*q) {
+    case 't':
+        ok = flag = literal("true");
+        break;
+    case 'f':
+        ok = literal("false");
+        flag = false;
+        break;
+    case 'n':
+        ok = literal("null");
+        flag = false;
+        type = JsonType::Null;
+        break;
+    default:
+        ok = Number(q, e, flag);
+        type = JsonType::Number;
+    }
+    pos = q - s;
+    if (!ok || Blank(pos, stop) != stop) {
+        return Fail(ok ? Blank(pos, stop) : type == JsonType::Number ? pos : start);
+    }
+    nodes.push_back({ type, flag, pos - start, start, uint32_t(nodes.size() + 1) });
+    return true;
+}
+
+inline uint32_t Json::Blank(uint32_t start, uint32_t stop) const
+{
+    // Single spaces are skipped inline, and runs of them, as in
+    // indentation, with a scan kernel.
+    static constexpr CharSet space(" \t\n\r");
+    auto s = text.data();
+    auto q = s + start;
+    auto e = s + stop;
+    while (q != e && space.Has(*q)) {
+        if (++q != e && *q == ' ') {
+            q = scan::FindNotIn(q, e, ' ', ' ');
+        }
+    }
+    return q - s;
+}
+
+bool Json::Fail(uint32_t offset)
+{
+    failure = offset;
+    return false;
+}
+
+bool Json::Escape(Parser& p)
+{
+    static constexpr CharSet escapes("\"\\/bfnrt");
+    uint32_t code;
+    if (p.Match(escapes)) {
+        return true;
+    }
+    if (!(p.Match('u') && Hex(p, code)) || (code >= 0xDC00 && code < 0xE000)) {
+        return false;
+    }
+    if (code >= 0xD800 && code < 0xDC00) {
+        return p.Match('\\') && p.Match('u') && Hex(p, code) && code >= 0xDC00 && code < 0xE000;
+    }
+    return true;
+}
+
+bool Json::Hex(Parser& p, uint32_t& code)
+{
+    auto t = p.Tail();
+    if (t.size() < 4 || std::from_chars(t.data(), t.data() + 4, code, 16).ptr != t.data() + 4) {
+        return false;
+    }
+    p.Advance(4);
+    return true;
+}
+
+bool Json::Number(const char*& q, const char* e, bool& integer)
+{
+    auto digits = [&]() {
+        auto d = q;
+        while (q != e && *q >= '0' && *q <= '9') {
+            q++;
+        }
+        return q != d;
+    };
+    if (q != e && *q == '-') {
+        q++;
+    }
+    // A leading zero is the whole integer part.
+    bool ok = true;
+    if (q != e && *q == '0') {
+        q++;
+    } else {
+        ok = digits();
+    }
+    integer = true;
+    if (ok && q != e && *q == '.') {
+        integer = false;
+        q++;
+        ok = digits();
+    }
+    if (ok && q != e && (*q == 'e' || *q == 'E')) {
+        integer = false;
+        if (++q != e && (*q == '-' || *q == '+')) {
+            q++;
+        }
+        ok = digits();
+    }
+    return ok;
+}
+
+void Json::Space(Parser& p)
+{
+    // Single spaces are skipped inline, and runs of them, as in
+    // indentation, with a scan kernel.
+    static constexpr CharSet space(" \t\n\r");
+    auto start = p.Tail().data();
+    auto q = start;
+    auto e = q + p.Tail().size();
+    while (q != e && space.Has(*q)) {
+        if (++q != e && *q == ' ') {
+            q = scan::FindNotIn(q, e, ' ', ' ');
+        }
+    }
+    p.Advance(q - start);
+}
+
+std::string_view Json::Text(uint32_t index, std::string& storage) const
+{
+    auto& n = nodes[index];
+    if (!n.flag) {
+        return text.substr(n.offset, n.size);
+    }
+    Parser(text.substr(n.offset - 1, n.size + 2)).String('"', storage);
+    return storage;
+}
+
+JsonCursor::JsonCursor(std::string_view text)
+{
+    Parser p(text);
+    Json::Space(p);
+    this->text = p.Tail();
+}
+
+bool JsonCursor::Ok() const
+{
+    return !text.empty();
+}
+
+JsonType JsonCursor::Type() const
+{
+    switch (Ok() ? text[0] : 'n') {
+    case '{':
+        return JsonType::Object;
+    case '[':
+        return JsonType::Array;
+    case '"':
+        return JsonType::String;
+    case 't':
+    case 'f':
+        return JsonType::Bool;
+    case 'n':
+        return JsonType::Null;
+    default:
+        return JsonType::Number;
+    }
+}
+
+bool JsonCursor::Get(bool& out) const
+{
+    auto v = Raw();
+    if (Type() != JsonType::Bool || (v != "true" && v != "false")) {
+        return false;
+    }
+    out = v == "true";
+    return true;
+}
+
+bool JsonCursor::Get(double& out) const
+{
+    // Raw is empty unless the number is valid JSON.
+    auto v = Raw();
+    auto r = std::from_chars(v.data(), v.data() + v.size(), out);
+    return Type() == JsonType::Number && !v.empty() && r.ec == std::errc() && r.ptr == v.data() + v.size();
+}
+
+bool JsonCursor::Get(int64_t& out) const
+{
+    auto v = Raw();
+    auto r = std::from_chars(v.data(), v.data() + v.size(), out);
+    return Type() == JsonType::Number && !v.empty() && r.ec == std::errc() && r.ptr == v.data() + v.size();
+}
+
+bool JsonCursor::Get(uint64_t& out) const
+{
+    auto v = Raw();
+    auto r = std::from_chars(v.data(), v.data() + v.size(), out);
+    return Type() == JsonType::Number && !v.empty() && r.ec == std::errc() && r.ptr == v.data() + v.size();
+}
+
+bool JsonCursor::Get(std::string& out) const
+{
+    Parser p(text);
+    return Type() == JsonType::String && p.String('"', out);
+}
+
+std::string_view JsonCursor::Raw() const
+{
+    Parser p(text);
+    auto m = p.Mark();
+    if (!Skip(p)) {
+        return {};
+    }
+    auto v = p.Token(m);
+    return Type() == JsonType::String ? v.substr(1, v.size() - 2) : v;
+}
+
+JsonCursor JsonCursor::operator[](size_t i) const
+{
+    if (Type() != JsonType::Array) {
+        return {};
+    }
+    Parser p(text);
+    p.Next();
+    Json::Space(p);
+    if (p.Equal(']')) {
+        return {};
+    }
+    for (;; i--) {
+        Json::Space(p);
+        if (i == 0) {
+            return At(p);
+        }
+        if (!Skip(p)) {
+            return {};
+        }
+        Json::Space(p);
+        if (!p.Match(',')) {
+            return {};
+        }
+    }
+}
+
+JsonCursor JsonCursor::operator[](std::string_view key) const
+{
+    if (Type() != JsonType::Object) {
+        return {};
+    }
+    Parser p(text);
+    p.Next();
+    for (;;) {
+        Json::Space(p);
+        auto m = p.Mark();
+        if (!p.Equal('"') || !p.String('"')) {
+            return {};
+        }
+        // Keys are compared as they are, unless they have escapes.
+        auto k = p.Token(m);
+        k = k.substr(1, k.size() - 2);
+        bool found = k == key;
+        if (!found && k.find('\\') != std::string_view::npos) {
+            std::string unescaped;
+            Parser(m).String('"', unescaped);
+            found = unescaped == key;
+        }
+        Json::Space(p);
+        if (!p.Match(':')) {
+            return {};
+        }
+        Json::Space(p);
+        if (found) {
+            return At(p);
+        }
+        if (!Skip(p)) {
+            return {};
+        }
+        Json::Space(p);
+        if (!p.Match(',')) {
+            return {};
+        }
+    }
+}
+
+JsonCursor JsonCursor::At(Parser& p)
+{
+    static constexpr CharSet end(",]}");
+    if (!p.More() || end.Has(p.Curr())) {
+        return {};
+    }
+    return JsonCursor(p.Tail());
+}
+
+bool JsonCursor::Skip(Parser& p)
+{
+    static constexpr CharSet end(",]} \t\n\r");
+    if (p.Equal('"')) {
+        return p.String('"');
+    }
+    if (!p.Equal('{') && !p.Equal('[')) {
+        // Scalars are checked with the grammar of Json, and must be
+        // followed by the end of the text or of the value.
+        bool ok;
+        if (p.Equal('t') || p.Equal('f') || p.Equal('n')) {
+            ok = p.Match("true") || p.Match("false") || p.Match("null");
+        } else {
+            auto t = p.Tail();
+            auto q = t.data();
+            bool integer;
+            ok = Json::Number(q, q + t.size(), integer);
+            p.Advance(q - t.data());
+        }
+        return ok && (!p.More() || end.Has(p.Curr()));
+    }
+    auto t = p.Tail();
+    auto close = Close(t.data(), t.data() + t.size());
+    if (!close) {
+        return false;
+    }
+    p.Advance(close - t.data());
+    return true;
+}
+
+int JsonCursor::Bracket(std::string& open, char c)
+{
+    if (c == '{' || c == '[') {
+        open.push_back(c);
+        return 0;
+    }
+    // The close brackets are two characters after the open ones.
+    if (open.empty() || open.back() + 2 != c) {
+        return -1;
+    }
+    open.pop_back();
+    return open.empty();
+}
+
+const char* JsonCursor::Close(const char* p, const char* e)
+{
+    // Counts the brackets up to the one that closes the value, 64
+    // characters at a time. The bits of the characters in strings are
+    // found by xoring together the bits of the quotes before them.
+    // Blocks with backslashes are read one character at a time.
+    // The open brackets are kept to check that each close one matches.
+    static constexpr char chars[] = { '"', '\\', '{', '[', '}', ']' };
+    std::string open;
+    bool string = false;
+    bool escape = false;
+    char buf[64];
+    for (auto s = p; s < e; s += 64) {
+        auto block = s;
+        if (e - s < 64) {
+            std::fill(buf, buf + 64, ' ');
+            std::copy(s, e, buf);
+            block = buf;
+        }
+        uint64_t m[6];
+        scan::Masks(block, chars, 6, m);
+        if (m[1] == 0 && !escape) {
+            auto inside = m[0];
+            for (int i = 1; i < 64; i <<= 1) {
+                inside ^= inside << i;
+            }
+            inside ^= string ? ~uint64_t(0) : 0;
+            string = inside >> 63;
+            auto opens = (m[2] | m[3]) & ~inside;
+            auto closes = (m[4] | m[5]) & ~inside;
+            for (auto b = opens | closes; b; b &= b - 1) {
+                auto i = __builtin_ctzll(b);
+                if (auto end = Bracket(open, block[i])) {
+                    return end < 0 ? nullptr : s + i + 1;
+                }
+            }
+            continue;
+        }
+        for (int i = 0; i < 64; i++) {
+            auto c = block[i];
+            if (escape) {
+                escape = false;
+            } else if (string) {
+                escape = c == '\\';
+                string = c != '"';
+            } else if (c == '"') {
+                string = true;
+            } else if (c == '{' || c == '[' || c == '}' || c == ']') {
+                if (auto end = Bracket(open, c)) {
+                    return end < 0 ? nullptr : s + i + 1;
+                }
+            }
+        }
+    }
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <atomic>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <type_traits>
+
+#include "walker.hpp"
+
+// Splits the text into at most n chunks of about the same size,
+// or into one chunk if n is 0.
+// Each chunk but the last ends right after a delimiter,
+// so records that end with the delimiter are never split.
+std::vector<std::string_view> Split(std::string_view text, size_t n, char delim = '\n');
+
+// Splits the text into chunks of records ending with the delimiter,
+// runs f on a parser over each chunk on a pool of threads and
+// returns the results in the order of the chunks.
+// Uses one chunk per hardware thread if chunks is 0.
+// If f throws, no more chunks are started, and the exception of the
+// first chunk that threw is rethrown once all threads finish.
+template <typename F>
+auto ParseParallel(std::string_view text, F f, size_t chunks = 0, char delim = '\n')
+    -> std::vector<std::invoke_result_t<F, Parser&>>;
+
+std::vector<std::string_view> Split(std::string_view text, size_t n, char delim)
+{
+    std::vector<std::string_view> chunks;
+    Parser p(text);
+    n = std::max<size_t>(n, 1);
+    for (size_t i = 1; i <= n && p.More(); i++) {
+        if (i == n) {
+            chunks.push_back(p.Tail());
+            break;
+        }
+        auto m = p.Mark();
+        auto at = text.size() - m.size();
+        auto end = text.size() * i / n;
+        if (end > at) {
+            p.Advance(end - at - 1);
+            p.Until(delim);
+            p.Match(delim);
+            chunks.push_back(p.Token(m));
+        }
+    }
+    return chunks;
+}
+
+template <typename F>
+auto ParseParallel(std::string_view text, F f, size_t chunks, char delim)
+    -> std::vector<std::invoke_result_t<F, Parser&>>
+{
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    auto parts = Split(text, chunks ? chunks : threads, delim);
+    // One slot per chunk, as threads writing to the bits of a
+    // std::vector<bool> would race, and results need no default.
+    std::vector<std::optional<std::invoke_result_t<F, Parser&>>> slots(parts.size());
+    // Exceptions are kept per chunk as well, and must not leave the
+    // threads, which would terminate the program.
+    std::vector<std::exception_ptr> errors(parts.size());
+
+    std::atomic<size_t> next = 0;
+    std::atomic<bool> failed = false;
+    auto work = [&]() {
+        for (size_t i; !failed && (i = next++) < parts.size();) {
+            try {
+                Parser p(parts[i]);
+                slots[i].emplace(f(p));
+            } catch (...) {
+                errors[i] = std::current_exception();
+                failed = true;
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < std::min(threads, parts.size()); i++) {
+        pool.emplace_back(work);
+    }
+    work();
+    for (auto&& t : pool) {
+        t.join();
+    }
+    for (auto& e : errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+    std::vector<std::invoke_result_t<F, Parser&>> results;
+    results.reserve(slots.size());
+    for (auto& r : slots) {
+        results.push_back(std::move(*r));
+    }
+    return results;
+}
+
+#endif
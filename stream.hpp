@@ -0,0 +1,513 @@
+#ifndef STREAM_HPP
+#define STREAM_HPP
+
+#include <functional>
+#include <istream>
+#include <map>
+
+#include "walker.hpp"
+
+class StreamParser;
+
+// A position in the stream of a StreamParser.
+// The parser keeps the text from its oldest live mark in memory,
+// so a mark must not outlive the parser that made it.
+class StreamMark {
+public:
+    StreamMark(const StreamMark&);
+    StreamMark& operator=(const StreamMark&);
+    ~StreamMark();
+
+    // Returns the offset of the mark from the start of the stream.
+    uint64_t Offset() const;
+
+private:
+    friend class StreamParser;
+    StreamMark(StreamParser* p, uint64_t offset);
+
+    StreamParser* p;
+    uint64_t offset;
+};
+
+// Text parser that reads its input in chunks.
+// Only the text from the oldest live mark (or from the current
+// position if there are no marks) to the end of the last chunk read
+// is kept in memory, so loops of Line() or Until() over unbounded
+// input run in constant memory.
+// Views returned by Token() and Tail() are valid until the parser
+// reads more input, which any matching operation may do.
+// Supports the subset of Parser declared below. Float, Integer,
+// Until(std::string_view), Peek, Undo and Out are not available, and
+// marks are StreamMarks, which Back, Moved and Token take.
+class StreamParser {
+public:
+    // Reads up to size bytes into buf and returns how many were read.
+    // Returns 0 at the end of the input.
+    using Reader = std::function<size_t(char* buf, size_t size)>;
+
+    StreamParser(Reader read, size_t chunk = 1 << 16);
+    StreamParser(std::istream& in, size_t chunk = 1 << 16);
+    StreamParser(const StreamParser&) = delete;
+    StreamParser& operator=(const StreamParser&) = delete;
+
+    // Matches a string enclosed in quotes. Skips escaped quotes.
+    // Advances the parser if it matches.
+    bool String(char quote);
+    // Matches a string enclosed in quotes and outputs its unescaped
+    // contents. See Parser::String.
+    // Advances the parser if it matches.
+    bool String(char quote, std::string& out);
+    // Matches a number and outputs it. See Parser::Number.
+    // Advances the parser if it matches.
+    bool Number(int& out);
+    bool Number(int64_t& out);
+    bool Number(uint64_t& out);
+    bool Number(double& out);
+    // Matches a line (up to a newline character).
+    // Advances the parser if it matches.
+    bool Line();
+    // Matches whitespace characters.
+    // Advances the parser if it matches.
+    bool Space();
+    // Matches any character that is not the given ones.
+    // Advances the parser by one character if it does not match.
+    bool Not(char);
+    bool Not(char, char);
+    bool Not(std::pair<char, char> range);
+    bool Not(const CharSet&);
+    // Matches any character.
+    // Advances the parser if it matches.
+    bool Any();
+    // Matches until any given character.
+    // Advances the parser if it matches.
+    bool Until(char);
+    bool Until(char, char);
+    bool Until(std::pair<char, char> range);
+    bool Until(const CharSet&);
+    // Matches while in any given character range.
+    // Advances the parser if it matches.
+    bool While(std::pair<char, char> range);
+    bool While(const CharSet&);
+    // Matches the given characters or string.
+    // Advances the parser if it matches.
+    bool Match(char);
+    bool Match(char, char);
+    bool Match(std::pair<char, char> range);
+    bool Match(const CharSet&);
+    bool Match(std::string_view);
+    // Tests the given characters or string.
+    bool Equal(char);
+    bool Equal(char, char);
+    bool Equal(std::pair<char, char> range);
+    bool Equal(const CharSet&);
+    bool Equal(std::string_view);
+    // Returns a mark to the current position.
+    StreamMark Mark();
+    // Sets the parser to the marked position.
+    void Back(const StreamMark& m);
+    // Tells if the parser has moved from the marked position.
+    bool Moved(const StreamMark& m);
+    // Returns the token from the marked position to the current position.
+    std::string_view Token(const StreamMark& m);
+    // Returns the text read but not parsed yet.
+    std::string_view Tail();
+    // Returns the offset of the current position from the start of the stream.
+    uint64_t Offset();
+    // Returns the current character.
+    char Curr();
+    // Advances the parser by one character.
+    void Next();
+    // Tells if there are more characters to parse.
+    bool More();
+    // Returns how many bytes are kept in memory.
+    size_t Buffered();
+
+private:
+    friend class StreamMark;
+
+    // Reads one more chunk. Returns false at the end of the input.
+    bool Fill();
+    // Reads until n characters are available or the input ends.
+    void Fill(size_t n);
+    // Runs a test that looks at most n characters ahead.
+    template <typename F>
+    bool Test(size_t n, F f);
+    // Runs a scan that may stop at the end of the buffer,
+    // resuming it on the next chunk until it stops before the end.
+    template <typename F>
+    bool Scan(F f);
+    // Returns the size of the string at the current position with its
+    // quotes, reading until its closing quote, or 0 if the input ends
+    // before it.
+    size_t StringSize(char quote);
+    // Reads until a character that ends a number is available.
+    template <typename T>
+    bool ParseNumber(T& out);
+
+    Reader read;
+    size_t chunk;
+    // Text read and kept, followed by the padding for WALKER_PADDED.
+    std::string buf;
+    size_t filled = 0;
+    // Offset of buf[0] and of the current position in the stream.
+    uint64_t begin = 0;
+    uint64_t pos = 0;
+    bool eof = false;
+    // Number of live marks at each offset.
+    std::map<uint64_t, size_t> marks;
+};
+
+StreamMark::StreamMark(StreamParser* p, uint64_t offset)
+    : p(p)
+    , offset(offset)
+{
+    p->marks[offset]++;
+}
+
+StreamMark::StreamMark(const StreamMark& o)
+    : StreamMark(o.p, o.offset)
+{
+}
+
+StreamMark& StreamMark::operator=(const StreamMark& o)
+{
+    StreamMark copy(o);
+    std::swap(p, copy.p);
+    std::swap(offset, copy.offset);
+    return *this;
+}
+
+StreamMark::~StreamMark()
+{
+    auto it = p->marks.find(offset);
+    if (--it->second == 0) {
+        p->marks.erase(it);
+    }
+}
+
+uint64_t StreamMark::Offset() const
+{
+    return offset;
+}
+
+StreamParser::StreamParser(Reader read, size_t chunk)
+    : read(std::move(read))
+    , chunk(chunk)
+{
+}
+
+StreamParser::StreamParser(std::istream& in, size_t chunk)
+    : StreamParser([&in](char* buf, size_t size) {
+        in.read(buf, size);
+        return size_t(in.gcount());
+    },
+        chunk)
+{
+}
+
+bool StreamParser::String(char quote)
+{
+    if (!Equal(quote)) {
+        return false;
+    }
+    auto n = StringSize(quote);
+    pos += n;
+    return n != 0;
+}
+
+bool StreamParser::String(char quote, std::string& out)
+{
+    out.clear();
+    if (!Equal(quote)) {
+        return false;
+    }
+    // Unescapes once the whole string is read, as an escape may
+    // span two chunks.
+    auto n = StringSize(quote);
+    if (n == 0) {
+        return false;
+    }
+    Parser p(Tail().substr(0, n));
+    p.String(quote, out);
+    pos += n;
+    return true;
+}
+
+bool StreamParser::Number(int& out)
+{
+    return ParseNumber(out);
+}
+
+bool StreamParser::Number(int64_t& out)
+{
+    return ParseNumber(out);
+}
+
+bool StreamParser::Number(uint64_t& out)
+{
+    return ParseNumber(out);
+}
+
+bool StreamParser::Number(double& out)
+{
+    return ParseNumber(out);
+}
+
+template <typename T>
+bool StreamParser::ParseNumber(T& out)
+{
+    static constexpr CharSet number("0-9.eE+-");
+    for (size_t seen = 0;;) {
+        Parser p(Tail().substr(seen));
+        p.Until(~number);
+        seen = Tail().size();
+        if (p.More() || !Fill()) {
+            break;
+        }
+    }
+    return Test(0, [&](Parser& p) { return p.Number(out); });
+}
+
+bool StreamParser::Line()
+{
+    return Until('\n') + Match('\n');
+}
+
+bool StreamParser::Space()
+{
+    return While({ '\0' + 1, ' ' });
+}
+
+bool StreamParser::Not(char a)
+{
+    return Test(1, [&](Parser& p) { return p.Not(a); });
+}
+
+bool StreamParser::Not(char a, char b)
+{
+    return Test(1, [&](Parser& p) { return p.Not(a, b); });
+}
+
+bool StreamParser::Not(std::pair<char, char> range)
+{
+    return Test(1, [&](Parser& p) { return p.Not(range); });
+}
+
+bool StreamParser::Not(const CharSet& set)
+{
+    return Test(1, [&](Parser& p) { return p.Not(set); });
+}
+
+bool StreamParser::Any()
+{
+    return Test(1, [&](Parser& p) { return p.Any(); });
+}
+
+bool StreamParser::Until(char a)
+{
+    return Scan([&](Parser& p) { p.Until(a); });
+}
+
+bool StreamParser::Until(char a, char b)
+{
+    return Scan([&](Parser& p) { p.Until(a, b); });
+}
+
+bool StreamParser::Until(std::pair<char, char> range)
+{
+    return Scan([&](Parser& p) { p.Until(range); });
+}
+
+bool StreamParser::Until(const CharSet& set)
+{
+    return Scan([&](Parser& p) { p.Until(set); });
+}
+
+bool StreamParser::While(std::pair<char, char> range)
+{
+    return Scan([&](Parser& p) { p.While(range); });
+}
+
+bool StreamParser::While(const CharSet& set)
+{
+    return Scan([&](Parser& p) { p.While(set); });
+}
+
+bool StreamParser::Match(char a)
+{
+    return Test(1, [&](Parser& p) { return p.Match(a); });
+}
+
+bool StreamParser::Match(char a, char b)
+{
+    return Test(1, [&](Parser& p) { return p.Match(a, b); });
+}
+
+bool StreamParser::Match(std::pair<char, char> range)
+{
+    return Test(1, [&](Parser& p) { return p.Match(range); });
+}
+
+bool StreamParser::Match(const CharSet& set)
+{
+    return Test(1, [&](Parser& p) { return p.Match(set); });
+}
+
+bool StreamParser::Match(std::string_view v)
+{
+    return Test(v.size(), [&](Parser& p) { return p.Match(v); });
+}
+
+bool StreamParser::Equal(char a)
+{
+    return Test(1, [&](Parser& p) { return p.Equal(a); });
+}
+
+bool StreamParser::Equal(char a, char b)
+{
+    return Test(1, [&](Parser& p) { return p.Equal(a, b); });
+}
+
+bool StreamParser::Equal(std::pair<char, char> range)
+{
+    return Test(1, [&](Parser& p) { return p.Equal(range); });
+}
+
+bool StreamParser::Equal(const CharSet& set)
+{
+    return Test(1, [&](Parser& p) { return p.Equal(set); });
+}
+
+bool StreamParser::Equal(std::string_view v)
+{
+    return Test(v.size(), [&](Parser& p) { return p.Equal(v); });
+}
+
+StreamMark StreamParser::Mark()
+{
+    return StreamMark(this, pos);
+}
+
+void StreamParser::Back(const StreamMark& m)
+{
+    pos = m.offset;
+}
+
+bool StreamParser::Moved(const StreamMark& m)
+{
+    return pos != m.offset;
+}
+
+std::string_view StreamParser::Token(const StreamMark& m)
+{
+    return std::string_view(buf.data(), filled).substr(m.offset - begin, pos - m.offset);
+}
+
+std::string_view StreamParser::Tail()
+{
+    return std::string_view(buf.data(), filled).substr(pos - begin);
+}
+
+uint64_t StreamParser::Offset()
+{
+    return pos;
+}
+
+char StreamParser::Curr()
+{
+    Fill(1);
+    return More() ? buf[pos - begin] : '\0';
+}
+
+void StreamParser::Next()
+{
+    Fill(1);
+    pos++;
+}
+
+bool StreamParser::More()
+{
+    Fill(1);
+    return pos - begin < filled;
+}
+
+size_t StreamParser::Buffered()
+{
+    return filled;
+}
+
+bool StreamParser::Fill()
+{
+    if (eof) {
+        return false;
+    }
+    auto keep = marks.empty() ? pos : std::min(pos, marks.begin()->first);
+    buf.erase(0, keep - begin);
+    filled -= keep - begin;
+    begin = keep;
+
+    buf.resize(filled + chunk);
+    auto n = read(buf.data() + filled, chunk);
+    filled += n;
+    // Pads the text with zeros, for WALKER_PADDED.
+    buf.resize(filled);
+    buf.resize(filled + PaddedString::padding);
+    eof = n == 0;
+    return !eof;
+}
+
+void StreamParser::Fill(size_t n)
+{
+    while (Tail().size() < n && Fill()) { }
+}
+
+template <typename F>
+bool StreamParser::Test(size_t n, F f)
+{
+    Fill(n);
+    Parser p(Tail());
+    bool ok = f(p);
+    pos += Tail().size() - p.Tail().size();
+    return ok;
+}
+
+size_t StreamParser::StringSize(char quote)
+{
+    // Resumes after each read where the last scan stopped, so a long
+    // string is scanned once however many chunks it spans.
+    size_t n = 1;
+    for (;;) {
+        auto t = Tail();
+        auto s = t.data();
+        auto e = s + t.size();
+        auto q = s + n;
+        // Skips the character after each backslash, if it was read.
+        while ((q = scan::Find(q, e, quote, '\\')) != e && *q == '\\' && e - q >= 2) {
+            q += 2;
+        }
+        if (q != e && *q == quote) {
+            return q + 1 - s;
+        }
+        n = q - s;
+        if (!Fill()) {
+            return 0;
+        }
+    }
+}
+
+template <typename F>
+bool StreamParser::Scan(F f)
+{
+    auto start = pos;
+    for (;;) {
+        Parser p(Tail());
+        f(p);
+        pos += Tail().size() - p.Tail().size();
+        if (p.More() || !Fill()) {
+            break;
+        }
+    }
+    return pos != start;
+}
+
+#endif
@@ -1,7 +1,18 @@
 #include <assert.h>
+#include <cstdio>
+#include <deque>
+#include <fstream>
 #include <functional>
 #include <iostream>
-
+#include <sstream>
+
+#include "csv.hpp"
+#include "expr.hpp"
+#include "file.hpp"
+#include "grammar.hpp"
+#include "json.hpp"
+#include "parallel.hpp"
+#include "stream.hpp"
 #include "walker.hpp"
 
 #define assert_msg(cond, msg)                                 \
@@ -12,9 +23,22 @@
         assert(v);                                            \
     }
 
+// Returns the text followed by the padding that the scan kernels may
+// read when WALKER_PADDED is defined. The padded copies are kept until
+// the program ends. Without the define, returns the text itself.
+std::string_view Pad(std::string_view text)
+{
+#ifdef WALKER_PADDED
+    static std::deque<PaddedString> copies;
+    return copies.emplace_back(text).View();
+#else
+    return text;
+#endif
+}
+
 void Example_Expr()
 {
-    Parser p("(6-1)*4*2+(1+3)*(16/2)");
+    Parser p(Pad("(6-1)*4*2+(1+3)*(16/2)"));
 
     std::function<bool(int&)> expr, term, fact;
 
@@ -53,7 +77,7 @@ void Example_Expr()
 
 void Example_Json()
 {
-    Parser p(R"({ "name": "John", "country": [ "USA", "BRAZIL" ] })");
+    Parser p(Pad(R"({ "name": "John", "country": [ "USA", "BRAZIL" ] })"));
 
     std::function<bool(std::string&)> jsn, obj, arr, str, key;
 
@@ -101,8 +125,8 @@ void Example_Json()
 
 void Example()
 {
-    Parser p("point(1 20)\n"
-             "vector(-2 -30)");
+    Parser p(Pad("point(1 20)\n"
+             "vector(-2 -30)"));
 
     std::vector<std::tuple<std::string_view, int, int>> results;
     while (p.More()) {
@@ -123,101 +147,330 @@ void Example()
     assert(results[1] == std::make_tuple("vector", -2, -30));
 }
 
+void TestMemo()
+{
+    // Every alternative of expr parses term again after a failure,
+    // which takes exponential time in the nesting depth without a memo.
+    std::string text = std::string(10, '(') + "n" + std::string(10, ')');
+    for (bool memoize : { false, true }) {
+        Parser p(Pad(text));
+        Memo memo;
+        int calls = 0;
+        std::function<bool()> expr, term;
+        expr = [&]() {
+            auto m = p.Mark();
+            return p.Undo(m, term() && p.Match('+') && expr())
+                || p.Undo(m, term() && p.Match('-') && expr())
+                || term();
+        };
+        term = [&]() {
+            calls++;
+            auto rule = [&]() {
+                auto m = p.Mark();
+                return p.Undo(m, p.Match('(') && expr() && p.Match(')')) || p.Match('n');
+            };
+            return memoize ? memo.Run(p, 1, rule) : rule();
+        };
+        assert(expr() == true);
+        assert(p.Tail() == "");
+        assert(memoize ? calls == 11 * 3 : calls > 50000);
+    }
+
+    Parser p(Pad("ab"));
+    Memo memo;
+    auto ab = [&]() { return p.Match('a') && p.Match('x'); };
+    assert(memo.Run(p, 0, ab) == false);
+    assert(p.Tail() == "b");
+    p = Parser(Pad("ab"));
+    assert(memo.Run(p, 0, []() { return true; }) == false);
+    assert(p.Tail() == "b");
+}
+
+void TestMemo_Edit()
+{
+    // Statements like "x=1;", each parsed by a memoized rule.
+    std::string text;
+    for (int i = 0; i < 100; i++) {
+        text += "v" + std::to_string(i) + "=" + std::to_string(i * 7) + ";";
+    }
+    Memo memo;
+    int calls = 0;
+    auto parse = [&](std::string_view text) {
+        Parser p(Pad(text));
+        while (p.More()) {
+            bool ok = memo.Run(p, 1, [&]() {
+                calls++;
+                auto m = p.Mark();
+                return p.Undo(m, p.Match('v') && p.Integer() && p.Match('=') && p.Integer() && p.Match(';'));
+            });
+            if (!ok) {
+                return false;
+            }
+        }
+        return true;
+    };
+    auto edit = [&](size_t offset, size_t removed, std::string_view inserted) {
+        memo.Edit(text.size(), offset, removed, inserted.size());
+        text.replace(offset, removed, inserted);
+        calls = 0;
+        return parse(text);
+    };
+    assert(parse(text));
+    assert(calls == 100);
+
+    // Only the edited statement and the few before it within the
+    // lookahead run again.
+    auto offset = text.find("v50=");
+    assert(edit(offset + 4, 3, "12345"));
+    assert(calls >= 1 && calls <= 5);
+    assert(!edit(offset + 4, 5, "x"));
+    assert(edit(offset + 4, 1, "6"));
+    assert(calls >= 1 && calls <= 5);
+    assert(!edit(text.size(), 0, "v1=2"));
+    assert(edit(text.size(), 0, ";"));
+    // Removing and inserting whole statements.
+    assert(edit(0, text.find("v10="), ""));
+    assert(calls == 0);
+    assert(edit(text.find("v60="), 0, "v7=7;"));
+    assert(calls >= 1 && calls <= 5);
+
+    // Rules that failed after looking ahead are forgotten as well.
+    text = "while x";
+    memo.Clear();
+    auto keyword = [&](std::string_view text) {
+        Parser p(Pad(text));
+        return memo.Run(p, 2, [&]() { return p.Match("whilst"); });
+    };
+    assert(!keyword(text));
+    memo.Edit(text.size(), 4, 3, 2);
+    assert(keyword("whilst"));
+}
+
 void TestString()
 {
-    Parser p(R"("")");
+    Parser p(Pad(R"("")"));
     assert(p.String('"') == true);
     assert(p.Tail() == "");
 
-    p = Parser(R"("a")");
+    p = Parser(Pad(R"("a")"));
     assert(p.String('"') == true);
     assert(p.Tail() == "");
 
-    p = Parser(R"("a\"b\"c")");
+    p = Parser(Pad(R"("a\"b\"c")"));
     assert(p.String('"') == true);
     assert(p.Tail() == "");
 
-    p = Parser(R"("a\nb\"c")");
+    p = Parser(Pad(R"("a\nb\"c")"));
     assert(p.String('"') == true);
     assert(p.Tail() == "");
 
-    p = Parser(R"("a)");
+    p = Parser(Pad(R"("a)"));
     assert(p.String('"') == false);
     assert(p.Tail() == R"("a)");
 
-    p = Parser("''");
+    p = Parser(Pad("''"));
     assert(p.String('\'') == true);
     assert(p.Tail() == "");
 
-    p = Parser("'a'");
+    p = Parser(Pad("'a'"));
     assert(p.String('\'') == true);
     assert(p.Tail() == "");
 
-    p = Parser("'a\\'b\\'c'");
+    p = Parser(Pad("'a\\'b\\'c'"));
     assert(p.String('\'') == true);
     assert(p.Tail() == "");
 
-    p = Parser("'a\\'b\\'c'");
+    p = Parser(Pad("'a\\'b\\'c'"));
     assert(p.String('\'') == true);
     assert(p.Tail() == "");
 
-    p = Parser("'a");
+    p = Parser(Pad("'a"));
     assert(p.String('\'') == false);
     assert(p.Tail() == "'a");
+
+    // Escapes across the blocks of the vector scanner.
+    auto body = std::string(40, 'a') + "\\\\" + std::string(30, 'b') + "\\\"" + std::string(20, 'c');
+    auto text = "\"" + body + "\"x";
+    p = Parser(Pad(text));
+    assert(p.String('"') == true);
+    assert(p.Tail() == "x");
+
+    text = "\"" + std::string(40, 'a') + "\\";
+    p = Parser(Pad(text));
+    assert(p.String('"') == false);
+    assert(p.Tail().size() == 42);
+}
+
+void TestString_Unescape()
+{
+    std::string out = "old";
+    Parser p(Pad(R"("a\"b\\c\/\n\t" x)"));
+    assert(p.String('"', out) == true);
+    assert(out == "a\"b\\c/\n\t");
+    assert(p.Tail() == " x");
+
+    p = Parser(Pad(R"("\u0041\u00e9\u20ac\ud83d\ude00\uzz")"));
+    assert(p.String('"', out) == true);
+    assert(out == "A\u00e9\u20ac\U0001F600uzz");
+
+    p = Parser(Pad(R"("abc)"));
+    assert(p.String('"', out) == false);
+    assert(out.empty());
+    assert(p.Tail() == R"("abc)");
+
+    p = Parser(Pad(R"("abc\)"));
+    assert(p.String('"', out) == false);
+    assert(p.Tail() == R"("abc\)");
 }
 
 void TestPeek()
 {
-    Parser p("1+2");
-    assert(p.Peek(p.Mark(), p.Match('1') && p.Match('+') && p.Match('3')) == false);
+    Parser p(Pad("1+2"));
+    auto m = p.Mark();
+    assert(p.Peek(m, p.Match('1') && p.Match('+') && p.Match('3')) == false);
     assert(p.Tail() == "1+2");
-    assert(p.Peek(p.Mark(), p.Match('1') && p.Match('+') && p.Match('2')) == true);
+    assert(p.Peek(m, p.Match('1') && p.Match('+') && p.Match('2')) == true);
     assert(p.Tail() == "1+2");
 }
 
 void TestUndo()
 {
-    Parser p("1+2");
-    assert(p.Undo(p.Mark(), p.Match('1') && p.Match('+') && p.Match('3')) == false);
+    Parser p(Pad("1+2"));
+    auto m = p.Mark();
+    assert(p.Undo(m, p.Match('1') && p.Match('+') && p.Match('3')) == false);
     assert(p.Tail() == "1+2");
-    assert(p.Undo(p.Mark(), p.Match('1') && p.Match('+') && p.Match('2')) == true);
+    assert(p.Undo(m, p.Match('1') && p.Match('+') && p.Match('2')) == true);
     assert(p.Tail() == "");
 }
 
 void TestOut()
 {
-    Parser p("123a");
+    Parser p(Pad("123a"));
 
-    p = Parser("123a");
+    p = Parser(Pad("123a"));
     std::string_view out0;
-    assert(p.Out(p.Mark(), p.Match('a'), out0) == false);
+    auto m = p.Mark();
+    assert(p.Out(m, p.Match('a'), out0) == false);
     assert(out0 == "");
 
-    p = Parser("123a");
+    p = Parser(Pad("123a"));
     std::string_view out1;
-    assert(p.Out(p.Mark(), p.Integer(), out1) == true);
+    m = p.Mark();
+    assert(p.Out(m, p.Integer(), out1) == true);
     assert(out1 == "123");
 
-    p = Parser("123a");
+    p = Parser(Pad("123a"));
     std::string out2;
-    assert(p.Out(p.Mark(), p.Integer(), out2) == true);
+    m = p.Mark();
+    assert(p.Out(m, p.Integer(), out2) == true);
     assert(out2 == "123");
 
-    p = Parser("111a222");
+    p = Parser(Pad("111a222"));
     std::vector<std::string> out3;
-    assert(p.Out(p.Mark(), p.Integer(), out3) == true);
+    m = p.Mark();
+    assert(p.Out(m, p.Integer(), out3) == true);
     p.Match('a');
-    assert(p.Out(p.Mark(), p.Integer(), out3) == true);
+    m = p.Mark();
+    assert(p.Out(m, p.Integer(), out3) == true);
     assert(out3 == (std::vector<std::string> { "111", "222" }));
 
-    p = Parser("111a222");
+    p = Parser(Pad("111a222"));
     std::vector<std::string_view> out4;
-    assert(p.Out(p.Mark(), p.Integer(), out4) == true);
+    m = p.Mark();
+    assert(p.Out(m, p.Integer(), out4) == true);
     p.Match('a');
-    assert(p.Out(p.Mark(), p.Integer(), out4) == true);
+    m = p.Mark();
+    assert(p.Out(m, p.Integer(), out4) == true);
     assert(out4 == (std::vector<std::string_view> { "111", "222" }));
 }
 
+void TestTokens()
+{
+    enum { Word, Num };
+    Parser p(Pad("ab 12 cd"));
+    Tokens out;
+    while (p.More()) {
+        p.Space();
+        auto m = p.Mark();
+        if (!p.Out(m, p.While({ 'a', 'z' }), out, Word)) {
+            m = p.Mark();
+            assert(p.Out(m, p.Integer(), out, Num));
+        }
+    }
+    assert(out.Size() == 3);
+    assert(out.View(0) == "ab" && out.Kind(0) == Word);
+    assert(out.View(1) == "12" && out.Kind(1) == Num);
+    assert(out.Offset(2) == 6 && out.Length(2) == 2 && out.Kind(2) == Word);
+
+    // Clearing keeps the memory, and the tokens follow the new text.
+    out.Clear();
+    assert(out.Size() == 0);
+    p = Parser(Pad("xyz"));
+    auto m = p.Mark();
+    assert(p.Out(m, p.Match('x'), out) && !p.Out(m, p.Match('x'), out));
+    assert(out.Size() == 1 && out.View(0) == "x");
+}
+
+void TestTree()
+{
+    // Lists of numbers and names, where a name followed by '(' is a call.
+    enum { List, Num, Name, Call };
+    Parser p(Pad("[1, f(2), [x], g]"));
+    Tree tree;
+    p.Build(tree);
+    std::function<bool()> item, list;
+    item = [&]() {
+        p.Space();
+        auto m = p.Mark();
+        // The name of a call is parsed again as a name when it fails.
+        return p.Close(p.Open(Call) && p.Undo(m, p.Close(p.Open(Name) && p.While({ 'a', 'z' })) && p.Match('(') && item() && p.Match(')')))
+            || p.Close(p.Open(Num) && p.Integer())
+            || p.Close(p.Open(Name) && p.While({ 'a', 'z' }))
+            || list();
+    };
+    list = [&]() {
+        return p.Close(p.Open(List) && p.Match('[') && item() && [&]() {
+            while (p.Match(',') && item()) { }
+            return p.Match(']');
+        }());
+    };
+    assert(list() && !p.More());
+
+    std::vector<std::string> nodes;
+    for (size_t i = 0; i < tree.Size(); i++) {
+        nodes.push_back(std::to_string(tree.Kind(i)) + ":" + std::string(tree.View(i)));
+    }
+    assert(nodes == (std::vector<std::string> { "1:1", "2:f", "1:2", "3:f(2)", "2:x", "0:[x]", "2:g", "0:[1, f(2), [x], g]" }));
+    std::vector<size_t> children;
+    tree.Children(7, children);
+    assert(children == (std::vector<size_t> { 0, 3, 5, 6 }));
+    tree.Children(3, children);
+    assert(children == (std::vector<size_t> { 1, 2 }));
+    tree.Children(0, children);
+    assert(children.empty() && tree.First(0) == 0 && tree.First(7) == 0);
+    assert(tree.Start(3) == Pos { 4 } && tree.End(3) == Pos { 8 });
+
+    // Failing nodes drop their descendants, and Back drops what it rewinds.
+    tree.Clear();
+    p = Parser(Pad("[1, 2"));
+    p.Build(tree);
+    assert(!list());
+    assert(tree.Size() == 0);
+    p = Parser(Pad("7 8"));
+    p.Build(tree);
+    auto m = p.Mark<Pos>();
+    assert(p.Close(p.Open(Num) && p.Integer()));
+    p.Back(m);
+    assert(tree.Size() == 0);
+    auto start = p.Mark();
+    assert(p.Peek(start, item()) && tree.Size() == 0);
+    assert(item() && item() && tree.Size() == 2);
+
+    // Without a tree, rules still parse.
+    p = Parser(Pad("[1, f(2)]"));
+    assert(list() && !p.More() && tree.Size() == 2);
+}
+
 void TestNumber_Float()
 {
     auto ttTrue = std::vector<std::pair<std::string_view, float>> {
@@ -237,14 +490,14 @@ void TestNumber_Float()
 
     for (auto&& tc : ttTrue) {
         float out;
-        Parser p(tc.first);
+        Parser p(Pad(tc.first));
         assert_msg(p.Number(out) == true, tc.first);
         assert_msg(out == tc.second, tc.first);
         assert_msg(p.Tail() == "", tc.first);
     }
     for (auto&& tc : ttFalse) {
         float out = -1;
-        Parser p(tc);
+        Parser p(Pad(tc));
         assert_msg(p.Number(out) == false, tc);
         assert_msg(out == -1, tc);
         assert_msg(p.Tail() == tc, tc);
@@ -264,20 +517,128 @@ void TestNumber_Int()
 
     for (auto&& tc : ttTrue) {
         int out;
-        Parser p(tc.first);
+        Parser p(Pad(tc.first));
         assert(p.Number(out) == true);
         assert(out == tc.second);
         assert(p.Tail() == "");
     }
     for (auto&& tc : ttFalse) {
         int out = -1;
-        Parser p(tc);
+        Parser p(Pad(tc));
         assert(p.Number(out) == false);
         assert(out == -1);
         assert(p.Tail() == tc);
     }
 }
 
+void TestNumber_Wide()
+{
+    int64_t i64 = 0;
+    Parser p(Pad("-9223372036854775808,9223372036854775808"));
+    assert(p.Number(i64) == true);
+    assert(i64 == INT64_MIN);
+    assert(p.Match(',') == true);
+    assert(p.Number(i64) == false);
+    assert(p.Tail() == "9223372036854775808");
+
+    uint64_t u64 = 0;
+    assert(p.Number(u64) == true);
+    assert(u64 == 9223372036854775808u);
+
+    p = Parser(Pad("+18446744073709551615 18446744073709551616 -1"));
+    assert(p.Number(u64) == true);
+    assert(u64 == UINT64_MAX);
+    assert(p.Space() == true);
+    assert(p.Number(u64) == false);
+    p.Until(' ');
+    p.Space();
+    assert(p.Number(u64) == false);
+    assert(p.Tail() == "-1");
+
+    int i = 0;
+    p = Parser(Pad("2147483648"));
+    assert(p.Number(i) == false);
+    assert(p.Tail() == "2147483648");
+
+    double d = 0;
+    p = Parser(Pad("-1.5e300,1e400"));
+    assert(p.Number(d) == true);
+    assert(d == -1.5e300);
+    p.Match(',');
+    assert(p.Number(d) == false);
+    assert(p.Tail() == "1e400");
+
+    float f = 0;
+    p = Parser(Pad("+.25"));
+    assert(p.Number(f) == true);
+    assert(f == .25f);
+
+    p = Parser(Pad("+-1"));
+    assert(p.Number(i) == false);
+    assert(p.Number(d) == false);
+    assert(p.Tail() == "+-1");
+
+    // Number stops where Float does.
+    for (auto tc : { "1e5e", "4.3E2e1", "2e-3E" }) {
+        Parser p(Pad(tc));
+        assert_msg(p.Float() == true, tc);
+        auto tail = p.Tail();
+        p = Parser(Pad(tc));
+        assert_msg(p.Number(d) == true && p.Tail() == tail, tc);
+    }
+}
+
+void TestNumber_Digits()
+{
+    // Runs of digits longer than 8, cut at every position.
+    std::string digits = "12345678901234567890123";
+    for (size_t n = 1; n <= 19; n++) {
+        uint64_t u = 0;
+        Parser p(Pad(std::string_view(digits).substr(0, n)));
+        assert(p.Number(u) == true && p.Tail() == "");
+        assert(u == std::stoull(digits.substr(0, n)));
+    }
+    uint64_t u = 0;
+    Parser p(Pad("00000000000000000000000012345678x"));
+    assert(p.Number(u) == true && u == 12345678);
+    assert(p.Tail() == "x");
+
+    // Each rounds correctly, whether the fast path takes it or not.
+    auto tt = std::vector<std::pair<std::string_view, double>> {
+        { "0.1", 0.1 }, { "0.30000000000000004", 0.30000000000000004 },
+        { "9007199254740993", 9007199254740993.0 }, { "1e22", 1e22 }, { "1e23", 1e23 },
+        { "123456789012345678901234567890", 123456789012345678901234567890.0 },
+        { "2.2250738585072014e-308", 2.2250738585072014e-308 }, { "4.9e-324", 4.9e-324 },
+        { "1234.5678e-10", 1234.5678e-10 }, { "00000000000000000000001.5", 1.5 },
+    };
+    for (auto&& tc : tt) {
+        double d = 0;
+        Parser p(Pad(tc.first));
+        assert_msg(p.Number(d) == true && d == tc.second, tc.first);
+        assert_msg(p.Tail() == "", tc.first);
+    }
+    float f = 0;
+    p = Parser(Pad("16777217,0.1,3.4e38"));
+    assert(p.Number(f) && f == 16777217.0f && p.Match(','));
+    assert(p.Number(f) && f == 0.1f && p.Match(','));
+    assert(p.Number(f) && f == 3.4e38f);
+}
+
+void TestNumber_View()
+{
+    // The view ends before the digits that follow it in memory.
+    std::string_view text = "12345.678";
+    int i = 0;
+    Parser p(Pad(text.substr(0, 3)));
+    assert(p.Number(i) == true);
+    assert(i == 123);
+
+    double d = 0;
+    p = Parser(Pad(text.substr(0, 7)));
+    assert(p.Number(d) == true);
+    assert(d == 12345.6);
+}
+
 void TestFloat()
 {
     auto ttTrue = {
@@ -292,12 +653,12 @@ void TestFloat()
     };
 
     for (auto&& tc : ttTrue) {
-        Parser p(tc);
+        Parser p(Pad(tc));
         assert(p.Float() == true);
         assert(p.Tail() == "");
     }
     for (auto&& tc : ttFalse) {
-        Parser p(tc);
+        Parser p(Pad(tc));
         assert(p.Float() == false);
         assert(p.Tail() == tc);
     }
@@ -305,94 +666,94 @@ void TestFloat()
 
 void TestInteger()
 {
-    Parser p("2");
+    Parser p(Pad("2"));
     assert(p.Integer() == true);
     assert(p.Tail() == "");
 
-    p = Parser("23");
+    p = Parser(Pad("23"));
     assert(p.Integer() == true);
     assert(p.Tail() == "");
 
-    p = Parser("-2");
+    p = Parser(Pad("-2"));
     assert(p.Integer() == true);
     assert(p.Tail() == "");
 
-    p = Parser("+2");
+    p = Parser(Pad("+2"));
     assert(p.Integer() == true);
     assert(p.Tail() == "");
 
-    p = Parser("-");
+    p = Parser(Pad("-"));
     assert(p.Integer() == false);
     assert(p.Tail() == "-");
 
-    p = Parser("x");
+    p = Parser(Pad("x"));
     assert(p.Integer() == false);
     assert(p.Tail() == "x");
 }
 
 void TestLine()
 {
-    Parser p("\n");
+    Parser p(Pad("\n"));
     assert(p.Line() == true);
     assert(p.Tail() == "");
 
-    p = Parser("a\n");
+    p = Parser(Pad("a\n"));
     assert(p.Line() == true);
     assert(p.Tail() == "");
 
-    p = Parser("aaa\n");
+    p = Parser(Pad("aaa\n"));
     assert(p.Line() == true);
     assert(p.Tail() == "");
 
-    p = Parser("");
+    p = Parser(Pad(""));
     assert(p.Line() == false);
     assert(p.Tail() == "");
 
-    p = Parser("abc");
+    p = Parser(Pad("abc"));
     assert(p.Line() == true);
     assert(p.Tail() == "");
 }
 
 void TestSpace()
 {
-    Parser p("   x");
+    Parser p(Pad("   x"));
     assert(p.Space() == true);
     assert(p.Tail() == "x");
 }
 
 void TestNot()
 {
-    Parser p("ab");
+    Parser p(Pad("ab"));
     assert(p.Not('b') == true);
     assert(p.Tail() == "b");
     assert(p.Not('b') == false);
     assert(p.Tail() == "b");
 
-    p = Parser("ab");
+    p = Parser(Pad("ab"));
     assert(p.Not('b', 'c') == true);
     assert(p.Tail() == "b");
     assert(p.Not('a', 'b') == false);
     assert(p.Tail() == "b");
 
-    p = Parser("ab");
+    p = Parser(Pad("ab"));
     assert(p.Not({ '0', '9' }) == true);
     assert(p.Tail() == "b");
     assert(p.Not({ 'a', 'z' }) == false);
     assert(p.Tail() == "b");
 
-    p = Parser("aNot");
+    p = Parser(Pad("aNot"));
     assert(p.Not("Not") == true);
     assert(p.Tail() == "Not");
     assert(p.Not("Not") == false);
     assert(p.Tail() == "Not");
 
-    p = Parser("");
+    p = Parser(Pad(""));
     assert(p.Not('x') == false);
 }
 
 void TestAny()
 {
-    Parser p("ab");
+    Parser p(Pad("ab"));
     assert(p.Any() == true);
     assert(p.Tail() == "b");
     assert(p.Any() == true);
@@ -402,86 +763,234 @@ void TestAny()
 
 void TestUntil()
 {
-    Parser p("\n");
+    Parser p(Pad("\n"));
     assert(p.Until('\n') == false);
     assert(p.Tail() == "\n");
 
-    p = Parser("a\n");
+    p = Parser(Pad("a\n"));
     assert(p.Until('\n') == true);
     assert(p.Tail() == "\n");
 
-    p = Parser("aaa\n");
+    p = Parser(Pad("aaa\n"));
     assert(p.Until('\n') == true);
     assert(p.Tail() == "\n");
 
-    p = Parser("");
+    p = Parser(Pad(""));
     assert(p.Until('\n') == false);
     assert(p.Tail() == "");
 
-    p = Parser("abc");
+    p = Parser(Pad("abc"));
     assert(p.Until('\n') == true);
     assert(p.Tail() == "");
 
-    p = Parser("ab.");
+    p = Parser(Pad("ab."));
     assert(p.Until('.', ',') == true);
     assert(p.Tail() == ".");
 
-    p = Parser("ab.");
+    p = Parser(Pad("ab."));
     assert(p.Until(',', '.') == true);
     assert(p.Tail() == ".");
 
-    p = Parser("ab;");
+    p = Parser(Pad("ab;"));
     assert(p.Until(',', '.') == true);
     assert(p.Tail() == "");
 
-    p = Parser("");
+    p = Parser(Pad(""));
     assert(p.Until(',', '.') == false);
     assert(p.Tail() == "");
 }
 
 void TestUntil_Str()
 {
-    Parser p("abc123");
+    Parser p(Pad("abc123"));
     assert(p.Until("abc") == false);
     assert(p.Until("123") == true);
     assert(p.Tail() == "123");
+
+    p = Parser(Pad("aab aabaac"));
+    assert(p.Until("aac") == true);
+    assert(p.Tail() == "aac");
+    assert(p.Until("x") == true);
+    assert(p.Tail() == "");
+}
+
+void TestPatterns()
+{
+    Patterns keywords = { "if", "else", "elif", "bcd", "abcde", "" };
+    size_t which = 0;
+
+    Parser p(Pad("x = 1; elif y"));
+    assert(p.Until(keywords) == true);
+    assert(p.Tail() == "elif y");
+    assert(p.Equal(keywords, which) && keywords.Pattern(which) == "elif");
+    assert(p.Match(keywords, which) && which == 2);
+    assert(p.Tail() == " y");
+    assert(p.Match(keywords) == false);
+    assert(p.Until(keywords) == true);
+    assert(p.Tail() == "");
+
+    // The leftmost pattern wins over one that ends first.
+    p = Parser(Pad("xabcdef"));
+    assert(p.Until(keywords) == true);
+    assert(p.Tail() == "abcdef");
+    assert(p.Match(keywords, which) && which == 4);
+
+    p = Parser(Pad("abcdx"));
+    assert(p.Until(keywords) == true);
+    assert(p.Tail() == "bcdx");
+
+    // Many first bytes skip text without the scan kernels.
+    Patterns many = { "ab", "cd", "ef", "b" };
+    p = Parser(Pad("zzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzczcef"));
+    assert(p.Until(many) == true);
+    assert(p.Match(many, which) && which == 2);
+    assert(p.Tail() == "");
+
+    // Patterns may use all 256 byte values.
+    std::string bytes;
+    for (int c = 0; c < 256; c++) {
+        bytes += char(c);
+    }
+    Patterns all = { bytes, "\xff\x01" };
+    std::string text = std::string("ab\0\x01\xff\x02\xff\x01", 8) + bytes;
+    p = Parser(Pad(text));
+    assert(p.Until(all) == true);
+    assert(p.Tail().size() == 258 && p.Match(all, which) && which == 1);
+    assert(p.Match(all, which) && which == 0 && !p.More());
 }
 
 void TestUntil_Range()
 {
-    Parser p("abc123");
+    Parser p(Pad("abc123"));
     assert(p.Until({ '0', '9' }) == true);
     assert(p.Tail() == "123");
 }
 
+void TestScan()
+{
+    std::vector<const scan::Backend*> backends = { &scan::Scalar };
+#ifdef WALKER_X86
+    backends.push_back(&scan::Sse2);
+    if (__builtin_cpu_supports("avx2")) {
+        backends.push_back(&scan::Avx2);
+    }
+#endif
+    std::string text;
+    for (int i = 0; i < 300; i++) {
+        text += "ab \t\x80Z9\n,\xff"[(i * 7 + i / 13) % 10];
+    }
+    // Sets that fit the nibble masks or not, and their complements.
+    std::vector<CharSet> sets = { CharSet(",9\n"), CharSet("\x80\xff"), CharSet("a-zA-Z0-9_") };
+    std::string many;
+    for (int c = 0; c < 256; c += 17) {
+        many += char(c);
+    }
+    sets.push_back(CharSet(many));
+    for (size_t i = 0, n = sets.size(); i < n; i++) {
+        sets.push_back(~sets[i]);
+    }
+    // Kernels may read past the end when WALKER_PADDED is defined.
+    PaddedString padded(text);
+    for (auto b : backends) {
+        for (size_t from = 0; from < 40; from++) {
+            for (size_t to = from; to < text.size(); to += 37) {
+                auto p = padded.View().data() + from;
+                auto e = padded.View().data() + to;
+                assert_msg(b->find(p, e, '\n') == scan::Scalar.find(p, e, '\n'), b->name);
+                assert_msg(b->find(p, e, '\xff') == scan::Scalar.find(p, e, '\xff'), b->name);
+                assert_msg(b->find2(p, e, ',', '9') == scan::Scalar.find2(p, e, ',', '9'), b->name);
+                assert_msg(b->findIn(p, e, '0', '9') == scan::Scalar.findIn(p, e, '0', '9'), b->name);
+                assert_msg(b->findIn(p, e, '\x80', '\x90') == scan::Scalar.findIn(p, e, '\x80', '\x90'), b->name);
+                assert_msg(b->findNotIn(p, e, 'a', 'z') == scan::Scalar.findNotIn(p, e, 'a', 'z'), b->name);
+                assert_msg(b->findNotIn(p, e, '\1', ' ') == scan::Scalar.findNotIn(p, e, '\1', ' '), b->name);
+                if (e - p >= 64) {
+                    const char chars[] = { '\n', ',', '\xff' };
+                    uint64_t m[3], want[3];
+                    b->masks(p, chars, 3, m);
+                    scan::Scalar.masks(p, chars, 3, want);
+                    assert_msg(std::equal(m, m + 3, want), b->name);
+                }
+                for (auto& set : sets) {
+                    assert_msg(b->findSet(p, e, set.Table()) == scan::Scalar.findSet(p, e, set.Table()), b->name);
+                    assert_msg(b->findNotSet(p, e, set.Table()) == scan::Scalar.findNotSet(p, e, set.Table()), b->name);
+                }
+            }
+        }
+    }
+
+    std::string line(1000, 'x');
+    auto input = line + "\n" + std::string(70, ' ') + "y";
+    Parser p(Pad(input));
+    assert(p.Until('\n') == true);
+    assert(p.Tail().size() == 72);
+    assert(p.Match('\n') == true);
+    assert(p.Space() == true);
+    assert(p.Tail() == "y");
+}
+
 void TestWhile()
 {
-    Parser p("...x");
+    Parser p(Pad("...x"));
     assert(p.While('x') == false);
     assert(p.Tail() == "...x");
     assert(p.While('.') == true);
     assert(p.Tail() == "x");
 
-    p = Parser("Name_123()");
+    p = Parser(Pad("Name_123()"));
     assert(p.While({ 'A', 'Z' }) == true);
     assert(p.Tail() == "ame_123()");
 
-    p = Parser("Name_123()");
+    p = Parser(Pad("Name_123()"));
     assert(p.While({ 'A', 'Z' }, { 'a', 'z' }) == true);
     assert(p.Tail() == "_123()");
 
-    p = Parser("Name_123()");
+    p = Parser(Pad("Name_123()"));
     assert(p.While({ 'A', 'Z' }, { 'a', 'z' }, { '_', '_' }) == true);
     assert(p.Tail() == "123()");
 
-    p = Parser("Name_123()");
+    p = Parser(Pad("Name_123()"));
     assert(p.While({ 'A', 'Z' }, { 'a', 'z' }, { '_', '_' }, { '0', '9' }) == true);
     assert(p.Tail() == "()");
 }
 
+void TestCharSet()
+{
+    constexpr CharSet ident("a-zA-Z0-9_");
+    static_assert(ident.Has('q') && ident.Has('Q') && ident.Has('5') && ident.Has('_'));
+    static_assert(!ident.Has('-') && !ident.Has(' ') && !ident.Has('\0'));
+
+    constexpr CharSet dash("-a-c-");
+    static_assert(dash.Has('-') && dash.Has('b') && !dash.Has('d'));
+
+    constexpr CharSet hex = CharSet({ { '0', '9' }, { 'a', 'f' } }) | CharSet("A-F");
+    static_assert(hex.Has('B') && hex.Has('e') && !hex.Has('g'));
+    static_assert((~hex).Has('g') && !(~hex).Has('0'));
+
+    Parser p(Pad("Name_123()"));
+    assert(p.While(ident) == true);
+    assert(p.Tail() == "()");
+    assert(p.While(ident) == false);
+
+    p = Parser(Pad("abc(x)"));
+    assert(p.Until(CharSet("()")) == true);
+    assert(p.Tail() == "(x)");
+    assert(p.Until(CharSet("()")) == false);
+    assert(p.Equal(CharSet("(")) == true);
+    assert(p.Match(CharSet("a-z")) == false);
+    assert(p.Not(CharSet("a-z")) == true);
+    assert(p.Match(CharSet("a-z")) == true);
+    assert(p.Not(CharSet(")")) == false);
+    assert(p.Tail() == ")");
+
+    p = Parser(Pad(""));
+    assert(p.Equal(~CharSet("")) == false);
+    assert(p.Match(~CharSet("")) == false);
+    assert(p.While(~CharSet("")) == false);
+}
+
 void TestMatch_Range()
 {
-    Parser p("abc");
+    Parser p(Pad("abc"));
     assert(p.Match({ 'A', 'C' }) == false);
     assert(p.Match({ 'a', 'c' }) == true);
     assert(p.Tail() == "bc");
@@ -493,7 +1002,7 @@ void TestMatch_Range()
 
 void TestMatch_Str()
 {
-    Parser p("Hi");
+    Parser p(Pad("Hi"));
     assert(p.Match("No") == false);
     assert(p.Tail() == "Hi");
     assert(p.Match("Hi") == true);
@@ -502,29 +1011,29 @@ void TestMatch_Str()
 
 void TestMatch_Char()
 {
-    Parser p("Hi");
+    Parser p(Pad("Hi"));
     assert(p.Match('X') == false);
     assert(p.Match('H') == true);
     assert(p.Tail() == "i");
     assert(p.Match('i') == true);
     assert(p.Tail() == "");
 
-    p = Parser("Hi");
+    p = Parser(Pad("Hi"));
     assert(p.Match('X', 'H') == true);
     assert(p.Tail() == "i");
 
-    p = Parser("Hi");
+    p = Parser(Pad("Hi"));
     assert(p.Match('H', 'X') == true);
     assert(p.Tail() == "i");
 
-    p = Parser("Hi");
+    p = Parser(Pad("Hi"));
     assert(p.Match('X', 'Y') == false);
     assert(p.Tail() == "Hi");
 }
 
 void TestEqual_Str()
 {
-    Parser p("Hi");
+    Parser p(Pad("Hi"));
     assert(p.Equal("Hi") == true);
     assert(p.Equal("No") == false);
     assert(p.Tail() == "Hi");
@@ -532,7 +1041,7 @@ void TestEqual_Str()
 
 void TestEqual_Range()
 {
-    Parser p("a");
+    Parser p(Pad("a"));
     assert(p.Equal({ 'A', 'B' }) == false);
     assert(p.Equal({ 'a', 'a' }) == true);
     assert(p.Equal({ 'a', 'b' }) == true);
@@ -541,7 +1050,7 @@ void TestEqual_Range()
 
 void TestEqual_Char()
 {
-    Parser p("Hi");
+    Parser p(Pad("Hi"));
     assert(p.Equal('H') == true);
     assert(p.Equal('i') == false);
     assert(p.Tail() == "Hi");
@@ -552,9 +1061,578 @@ void TestEqual_Char()
     assert(p.Tail() == "Hi");
 }
 
+void TestFailure()
+{
+    Parser p(Pad("{\n  \"a\": [1, x]\n}"));
+    std::function<bool()> value = [&]() {
+        p.Space();
+        auto m = p.Mark();
+        if (p.Match('[')) {
+            if (value()) {
+                while (p.Match(',') && value()) { }
+            }
+            return p.Undo(m, p.Match(']'));
+        }
+        if (p.Match('{')) {
+            p.Space();
+            if (p.String('"') && p.Match(':') && value()) {
+                p.Space();
+                return p.Undo(m, p.Match('}'));
+            }
+            return p.Undo(m, false);
+        }
+        int n;
+        return p.Number(n) || p.String('"') || p.Fail("value");
+    };
+    assert(value() == false);
+    assert(p.Tail() == p.Mark());
+    assert(p.Failure() == "x]\n}");
+#ifdef WALKER_EXPECTED
+    assert(p.Expected() == (std::vector<std::string> { "'['", "'{'", "number", "string", "value", "']'" }));
+#else
+    assert(p.Expected() == (std::vector<std::string> { "value" }));
+#endif
+    auto loc = p.Locate(p.Failure());
+    assert(loc.line == 2 && loc.column == 12);
+
+    p = Parser(Pad("abc"));
+    assert(p.Match("abd") == false);
+    assert(p.Match('x', 'y') == false);
+    assert(p.Match({ '0', '9' }) == false);
+    assert(p.Failure() == "abc");
+#ifdef WALKER_EXPECTED
+    assert(p.Expected() == (std::vector<std::string> { "\"abd\"", "'x'", "'y'", "'0'-'9'" }));
+#endif
+    p.Next();
+    assert(p.Match('x') == false);
+#ifdef WALKER_EXPECTED
+    assert(p.Expected() == (std::vector<std::string> { "'x'" }));
+#endif
+    assert(p.Offset(p.Failure()) == 1);
+
+    // Texts built at runtime are copied.
+    p = Parser(Pad("abc"));
+    assert(p.Fail(std::string("name")) == false);
+    assert(p.Match(std::string("abd")) == false);
+#ifdef WALKER_EXPECTED
+    assert(p.Expected() == (std::vector<std::string> { "name", "\"abd\"" }));
+#else
+    assert(p.Expected() == (std::vector<std::string> { "name" }));
+#endif
+
+    // Scanning primitives do not record the failure that stops them.
+    p = Parser(Pad("aaa.b"));
+    assert(p.While('a') && p.Line());
+    assert(p.Expected().empty());
+    assert(p.Offset(p.Failure()) == 0);
+
+    p = Parser(Pad("ab"));
+    assert(p.Match('a') && !p.Match('x'));
+    assert(p.Offset(p.Failure()) == 1);
+#ifndef WALKER_EXPECTED
+    assert(p.Expected().empty());
+#endif
+}
+
+void TestLocate()
+{
+    Parser p(Pad("ab\ncd\n\nef"));
+    auto a = p.Mark();
+    p.Until('d');
+    auto d = p.Mark();
+    p.Until('f');
+    auto f = p.Mark();
+    p.Next();
+    auto end = p.Mark();
+    assert(p.Locate(a).line == 1 && p.Locate(a).column == 1);
+    assert(p.Locate(d).line == 2 && p.Locate(d).column == 2);
+    assert(p.Locate(f).line == 4 && p.Locate(f).column == 2);
+    assert(p.Locate(end).line == 4 && p.Locate(end).column == 3);
+    assert(p.Offset(end) == 9);
+}
+
+void TestProfile()
+{
+#ifdef WALKER_PROFILE
+    profile::Reset();
+#endif
+    std::string text = "abc 123x 45 z";
+    Parser p(Pad(text));
+    auto word = [&] { return p.Profile("word", [&] { return p.While({ 'a', 'z' }); }); };
+    auto number = [&] {
+        return p.Profile("number", [&] {
+            auto m = p.Mark();
+            return p.Undo(m, p.Integer() && p.Match('x'));
+        });
+    };
+    assert(word() && p.Space() && number() && p.Space());
+    assert(number() == false && word() == false);
+    assert(p.Tail() == "45 z");
+    // Names built at runtime need not outlive the call.
+    for (int i = 0; i < 2; i++) {
+        assert(p.Profile(std::string("dynamic rule name"), [] { return true; }));
+    }
+    assert(p.Profile("control\tin\nname", [] { return true; }));
+
+#ifdef WALKER_PROFILE
+    auto all = profile::Snapshot();
+    auto find = [&](std::string_view name) {
+        return *std::find_if(all.begin(), all.end(), [&](auto& c) { return c.name == name; });
+    };
+    auto c = find("number");
+    assert(c.rule && c.calls == 2 && c.successes == 1 && c.bytes == 4);
+    assert(c.backtracks == 1 && c.backtracked == 2);
+    assert(all[0].name == "number");
+    c = find("word");
+    assert(c.rule && c.calls == 2 && c.successes == 1 && c.bytes == 3 && c.backtracks == 0);
+    // Space calls While, which counts as part of Space.
+    c = find("While");
+    assert(!c.rule && c.calls == 2 && c.successes == 1 && c.bytes == 3);
+    c = find("Space");
+    assert(c.calls == 2 && c.successes == 2 && c.bytes == 2);
+    c = find("Integer");
+    assert(c.calls == 2 && c.successes == 2 && c.bytes == 5);
+    c = find("Match");
+    assert(c.calls == 2 && c.successes == 1 && c.bytes == 1);
+
+    auto report = profile::Report();
+    assert(report.find("number") < report.find("word"));
+    auto json = profile::ReportJson();
+    assert(json.find(R"({"name": "number", "kind": "rule", "calls": 2, "successes": 1, "bytes": 4, "backtracks": 1, "backtracked": 2})") != std::string::npos);
+    assert(json.find(R"("control\u0009in\u000aname")") != std::string::npos);
+    Json doc;
+    assert(doc.Parse(Pad(json)) && doc.Root().Size() == 8);
+
+    // Counts of finished threads are kept.
+    std::string lines;
+    for (int i = 0; i < 1000; i++) {
+        lines += "abc\n";
+    }
+    ParseParallel(
+        Pad(lines), [](Parser& p) {
+            while (p.Profile("line", [&] { return p.Line(); })) { }
+            return 0;
+        },
+        4);
+    all = profile::Snapshot();
+    assert(find("line").calls == 1004 && find("line").successes == 1000 && find("line").bytes == 4000);
+
+    // Snapshots can be taken while other threads are profiling.
+    std::atomic<bool> done = false;
+    std::thread snapshots([&] {
+        while (!done) {
+            profile::Snapshot();
+        }
+    });
+    ParseParallel(
+        Pad(lines), [](Parser& p) {
+            for (int i = 0; i < 20; i++) {
+                auto m = p.Mark();
+                while (p.Profile("again", [&] { return p.Line(); })) { }
+                p.Back(m);
+            }
+            return 0;
+        },
+        4);
+    done = true;
+    snapshots.join();
+    all = profile::Snapshot();
+    assert(find("again").calls == 20 * 1004);
+#endif
+}
+
+void TestGrammar()
+{
+    using namespace grammar;
+
+    // A recursive grammar of nested lists of numbers.
+    int sum = 0;
+    std::vector<std::string_view> words;
+    Rule value;
+    auto number = Action(Integer(), [&](std::string_view v) { sum += std::stoi(std::string(v)); });
+    auto word = Capture(+In('a', 'z'), words);
+    auto item = Space() >> (number | word | value);
+    value = '[' >> -(item >> *(Space() >> ',' >> item)) >> Space() >> ']';
+
+    Parser p(Pad("[1, [2, abc], [], [[3]], x] rest"));
+    assert(value(p) == true);
+    assert(p.Tail() == " rest");
+    assert(sum == 6);
+    assert(words == (std::vector<std::string_view> { "abc", "x" }));
+
+    // Sequences rewind when they fail part way.
+    p = Parser(Pad("[1, 2"));
+    assert(value(p) == false);
+    assert(p.Tail() == "[1, 2");
+
+    // Choices take the first alternative that matches.
+    auto keyword = (Str("if") | "else") >> !In('a', 'z');
+    p = Parser(Pad("iffy"));
+    assert(keyword(p) == false);
+    assert(p.Tail() == "iffy");
+    p = Parser(Pad("else x"));
+    assert(keyword(p) == true);
+    assert(p.Tail() == " x");
+
+    // Repeating a grammar that matches empty text stops.
+    auto spaces = *Space();
+    p = Parser(Pad("  x"));
+    assert(spaces(p) == true);
+    assert(p.Tail() == "x");
+
+    // Actions that return false reject the match.
+    auto even = Action(Integer(), [](std::string_view v) { return (v.back() - '0') % 2 == 0; });
+    p = Parser(Pad("13"));
+    assert(even(p) == false);
+    assert(p.Tail() == "13");
+
+    Tokens tokens;
+    double x;
+    auto pair = Capture(Float(), tokens, 1) >> ',' >> Number(x);
+    p = Parser(Pad("1.5,2.5"));
+    assert(pair(p) == true);
+    assert(tokens.Size() == 1 && tokens.View(0) == "1.5" && x == 2.5);
+
+    // An undefined rule fails.
+    Rule undefined;
+    assert(undefined(p) == false);
+
+    auto digits = Profile(+In('0', '9'), "digits") >> ';';
+    p = Parser(Pad("123;"));
+    assert(digits(p) == true && p.Tail() == "");
+
+#ifndef WALKER_EXPECTED
+    // Choices only try the alternatives that can start with the next
+    // character, or that can match nothing.
+    int tried = 0;
+    auto lower = Fn([&](Parser& p) { tried++; return p.While({ 'a', 'z' }); }, FirstSet::In('a', 'z'));
+    auto alt = lower | Integer() | String('"');
+    assert(alt.First().Has('7') && alt.First().Has('"') && !alt.First().Has(' '));
+    p = Parser(Pad("42"));
+    assert(alt(p) == true && tried == 0);
+    p = Parser(Pad("\"x\""));
+    assert(alt(p) == true && tried == 0);
+    p = Parser(Pad("abc"));
+    assert(alt(p) == true && tried == 1);
+    p = Parser(Pad(""));
+    assert(alt(p) == false && tried == 2);
+    auto maybe = lower | -Ch('-');
+    p = Parser(Pad("1"));
+    assert(maybe(p) == true && p.Tail() == "1" && tried == 2);
+
+    // Rules declared with their first characters are dispatched as well,
+    // even when they are defined after the choice.
+    Rule name(FirstSet::In('a', 'z'));
+    Rule count(FirstSet::In('0', '9'));
+    auto field = name | count;
+    name = lower;
+    count = +In('0', '9');
+    p = Parser(Pad("7"));
+    assert(field(p) == true && p.Tail() == "" && tried == 2);
+    p = Parser(Pad("-"));
+    assert(field(p) == false && tried == 3);
+    p = Parser(Pad("ab"));
+    assert(field(p) == true && tried == 4);
+#endif
+    assert((Space() >> 'x').First().Has('y'));
+    assert(!(*Ch('a') >> 'b').First().Has('c') && !(*Ch('a') >> 'b').First().empty);
+}
+
+void TestJson()
+{
+    Json doc;
+    std::string text = R"( {
+        "name": "Jo\u00e3o \"J\"",
+        "age": 42,
+        "height": -1.75e0,
+        "tags": [ "a", [], {}, true, false, null ],
+        "k\u0065y": 0
+    } )";
+    assert(doc.Parse(Pad(text)) == true);
+    auto root = doc.Root();
+    assert(root.Type() == JsonType::Object && root.Size() == 5);
+
+    std::string_view name;
+    std::string storage;
+    assert(root["name"].Get(name, storage) && name == "Jo\u00e3o \"J\"");
+    assert(root["tags"][0].Get(name, storage) && name == "a" && name.data() != storage.data());
+    std::string copy;
+    assert(root["name"].Get(copy) && copy == "Jo\u00e3o \"J\"");
+    assert(root["tags"][0].Get(copy) && copy == "a");
+    assert(root["name"].Raw() == R"(Jo\u00e3o \"J\")");
+    int64_t age;
+    double height;
+    assert(root["age"].Get(age) && age == 42);
+    assert(root["height"].Get(height) && height == -1.75);
+    assert(root["height"].Get(age) == false);
+    assert(root["key"].Ok() && root["missing"].Ok() == false);
+    assert(root["missing"]["deeper"].Ok() == false);
+
+    auto tags = root["tags"];
+    assert(tags.Size() == 6);
+    assert(tags[1].Type() == JsonType::Array && tags[1].Size() == 0);
+    assert(tags[2].Type() == JsonType::Object && tags[2].First().Ok() == false);
+    bool b = false;
+    assert(tags[3].Get(b) && b == true);
+    assert(tags[4].Get(b) && b == false);
+    assert(tags[5].Type() == JsonType::Null);
+    assert(tags[6].Ok() == false);
+
+    std::vector<std::string> keys;
+    for (auto v = root.First(); v.Ok(); v = v.Next()) {
+        keys.emplace_back(v.Key(storage));
+    }
+    assert(keys == (std::vector<std::string> { "name", "age", "height", "tags", "key" }));
+
+    for (auto v : { "0", "-0", "1e5", "\"\"", "[[[]]]", " null " }) {
+        assert(doc.Parse(Pad(v)) == true);
+    }
+    uint64_t big;
+    assert(doc.Parse(Pad("18446744073709551615")) && doc.Root().Get(big) && big == UINT64_MAX);
+    assert(doc.Parse(Pad("18446744073709551616")) && doc.Root().Get(big) == false);
+    assert(doc.Parse(Pad("-1")) && doc.Root().Get(big) == false);
+
+    std::vector<std::string> invalid = { "", "01", "1.", ".5", "-", "1e", "+1", "[1,]", "{\"a\"}",
+        "{\"a\":1,}", "{a:1}", "[1 2]", "tru", "nul", "\"a", "\"\\x\"", "\"\\u12g4\"",
+        std::string("\"a\nb\""), "[1]]", "[\"a\"", "\"\xff\xfe\"", "\"\xc3\"", "\"\xed\xa0\x80\"",
+        "\"\\ud800\"", "\"\\udc00\"", "\"\\ud800\\u0041\"", "\"\\ud800x\"" };
+    for (auto& v : invalid) {
+        assert(doc.Parse(Pad(v)) == false);
+        assert(doc.Root().Ok() == false);
+    }
+    auto longer = "\"" + std::string(40, 'a') + "\\n" + std::string(40, 'b') + "\"";
+    assert(doc.Parse(Pad(longer)) == true);
+    assert(doc.Root().Raw().size() == 82);
+    longer[30] = '\t';
+    assert(doc.Parse(Pad(longer)) == false);
+    assert(doc.Error().column == 31);
+    assert(doc.Parse(Pad(std::string(2000, '[') + std::string(2000, ']'))) == false);
+    auto nested = std::string(1000, '[') + std::string(1000, ']');
+    assert(doc.Parse(Pad(nested)) == true);
+
+    assert(doc.Parse(Pad("\"\\ud83d\\ude00 \xf0\x9f\x98\x80\"")) && doc.Root().Get(name, storage) && name == "\xf0\x9f\x98\x80 \xf0\x9f\x98\x80");
+    assert(doc.Parse(Pad("[\"ab\xff\"]")) == false && doc.Error().column == 5);
+    assert(doc.Parse(Pad("{\n  \"a\": [1, x]\n}")) == false);
+    assert(doc.Error().line == 2 && doc.Error().column == 12);
+
+    // Escaped quotes and brackets in strings, with runs of backslashes
+    // across the 64 character blocks of the index.
+    for (size_t n = 55; n < 70; n++) {
+        for (auto run : { "\\\\", "\\\"", "\\\\\\\"", "\\\\\\\\", "]}:," }) {
+            auto s = "[\"" + std::string(n, 'a') + run + "\", {\"k\": [1]}]";
+            assert(doc.Parse(Pad(s)) == true);
+            assert(doc.Root().Size() == 2 && doc.Root()[1]["k"][0].Get(age) && age == 1);
+        }
+        auto odd = "[\"" + std::string(n, 'a') + "\\\\\\\", 1]";
+        assert(doc.Parse(Pad(odd)) == false);
+    }
+    // Errors are reported where they start, before the end of the string.
+    assert(doc.Parse(Pad("[\"\\\\\t]")) == false && doc.Error().column == 5);
+}
+
+void TestJsonCursor()
+{
+    std::string text = R"( {
+        "skip": { "a": [1, "]}", {"b": "\"{"}], "c": {} },
+        "user": { "name": "Jo\u00e3o", "id": 42, "ok": true, "w": -1.5 },
+        "list": [ [1, 2], "x", 3 ],
+        "k\u0065y": null
+    } )";
+    JsonCursor doc(Pad(text));
+    assert(doc.Type() == JsonType::Object);
+    int64_t id;
+    assert(doc["user"]["id"].Get(id) && id == 42);
+    std::string name;
+    assert(doc["user"]["name"].Get(name) && name == "Jo\u00e3o");
+    assert(doc["user"]["name"].Raw() == R"(Jo\u00e3o)");
+    bool ok = false;
+    assert(doc["user"]["ok"].Get(ok) && ok);
+    double w;
+    assert(doc["user"]["w"].Get(w) && w == -1.5);
+    assert(doc["user"]["w"].Get(id) == false);
+    assert(doc["list"][0][1].Get(id) && id == 2);
+    assert(doc["list"][1].Raw() == "x");
+    assert(doc["list"][2].Get(id) && id == 3);
+    assert(doc["list"][3].Ok() == false);
+    assert(doc["skip"]["c"].Raw() == "{}");
+    assert(doc["key"].Type() == JsonType::Null);
+    assert(doc["missing"].Ok() == false);
+    assert(doc["missing"]["id"].Ok() == false);
+    assert(doc["user"][0].Ok() == false);
+
+    // Skipping runs in blocks, with strings and escapes across them.
+    std::string skipped = "{ \"x\": [";
+    for (int i = 0; i < 50; i++) {
+        skipped += R"({"s": "]}\\\"[{", "t": [[]], "u": "\\\\"}, )";
+    }
+    skipped += "{} ], \"y\": 7 }";
+    int64_t y;
+    assert(JsonCursor(Pad(skipped))["y"].Get(y) && y == 7);
+    assert(JsonCursor(Pad(skipped))["x"][49]["t"].Raw() == "[[]]");
+    assert(JsonCursor(Pad(skipped))["x"][50].Raw() == "{}");
+
+    // Only the text read is validated.
+    JsonCursor broken(Pad(R"({"a": 1, "b": [1, 2, )"));
+    assert(broken["a"].Get(id) && id == 1);
+    assert(broken["b"].Raw().empty());
+    assert(broken["c"].Ok() == false);
+    assert(JsonCursor(Pad("[]"))[0].Ok() == false);
+    assert(JsonCursor(Pad("[1,]"))[1].Ok() == false);
+    assert(JsonCursor(Pad("[,1]"))[0].Ok() == false);
+    assert(JsonCursor(Pad(R"({"a": })"))["a"].Ok() == false);
+
+    // Skipped brackets must match.
+    assert(JsonCursor(Pad(R"({"a":[1},"b":2})"))["b"].Ok() == false);
+    assert(JsonCursor(Pad(R"({"a":{"x":[1]]},"b":2})"))["b"].Ok() == false);
+    std::string mismatched = R"({"a": [)" + std::string(100, ' ') + R"(}, "b": 2})";
+    assert(JsonCursor(Pad(mismatched))["b"].Ok() == false);
+    assert(JsonCursor(Pad(R"({"a":[{"x":"]"},[]],"b":2})"))["b"].Get(id) && id == 2);
+
+    // Scalars are checked with the grammar of Json.
+    assert(JsonCursor(Pad(R"({"a": xyz, "b": 1})"))["b"].Ok() == false);
+    assert(JsonCursor(Pad(R"({"a": truex, "b": 1})"))["b"].Ok() == false);
+    assert(JsonCursor(Pad(R"([1., 2])"))[1].Ok() == false);
+    assert(JsonCursor(Pad(R"([-0.5e+2, true, null, 2])"))[3].Get(id) && id == 2);
+    for (auto bad : { "+1", ".5", "1.", "01", "-", "1e", "0x1" }) {
+        assert(JsonCursor(Pad(bad)).Get(w) == false);
+        assert(JsonCursor(Pad(bad)).Get(id) == false);
+    }
+    uint64_t u;
+    assert(JsonCursor(Pad("-1")).Get(u) == false);
+    assert(JsonCursor(Pad("1.5")).Get(id) == false);
+    assert(JsonCursor(Pad("1e2")).Get(w) && w == 100);
+}
+
+void TestCsv()
+{
+    std::string text = "a,b,c\n1,\"x, \"\"y\"\"\",\r\n\"multi\nline\",,3";
+    CsvReader r(Pad(text));
+    std::vector<std::string_view> fields;
+    assert(r.Next(fields) && fields == (std::vector<std::string_view> { "a", "b", "c" }));
+    assert(r.Next(fields) && fields == (std::vector<std::string_view> { "1", R"(x, ""y"")", "" }));
+    std::string field;
+    CsvReader::Unquote(fields[1], field);
+    assert(field == R"(x, "y")");
+    assert(r.Next(fields) && fields == (std::vector<std::string_view> { "multi\nline", "", "3" }));
+    assert(r.Next(fields) == false);
+    assert(CsvReader(Pad("")).Next(fields) == false);
+
+    // Quotes and records across blocks.
+    std::string rows;
+    for (int i = 0; i < 300; i++) {
+        rows += std::to_string(i) + "\t\"q\t\"\"" + std::string(i % 70, 'x') + "\n\"\t" + std::to_string(i * 0.5) + "\n";
+    }
+    CsvReader tsv(Pad(rows), '\t');
+    for (int i = 0; i < 300; i++) {
+        assert(tsv.Next(fields) && fields.size() == 3);
+        assert(fields[0] == std::to_string(i));
+        assert(fields[1] == "q\t\"\"" + std::string(i % 70, 'x') + "\n");
+    }
+    assert(tsv.Next(fields) == false);
+
+    // Typed columns.
+    CsvReader typed(Pad("1,2.5,a\n2,-1e3,b\n3,x,c\n4,1,d\n"));
+    std::vector<int64_t> ids;
+    std::vector<double> values;
+    std::vector<std::string_view> names;
+    assert(typed.Batch(10, ids, values, names) == 2);
+    assert(ids == (std::vector<int64_t> { 1, 2 }));
+    assert(values == (std::vector<double> { 2.5, -1e3 }));
+    assert(names == (std::vector<std::string_view> { "a", "b" }));
+    assert(typed.Batch(10, ids, values) == 0 && ids.size() == 2);
+    assert(typed.Next(fields) && fields[1] == "x");
+    assert(typed.Batch(10, ids) == 1 && ids.back() == 4);
+
+    std::string lines;
+    for (int i = 1; i <= 10000; i++) {
+        lines += std::to_string(i) + ",n\n";
+    }
+    auto sums = ParseCsvParallel(
+        Pad(lines), [](CsvReader& r) {
+            std::vector<int64_t> ids;
+            while (r.Batch(1000, ids)) { }
+            int64_t sum = 0;
+            for (auto id : ids) {
+                sum += id;
+            }
+            return sum;
+        },
+        16);
+    int64_t total = 0;
+    for (auto s : sums) {
+        total += s;
+    }
+    assert(total == 10000 * 10001 / 2);
+
+    // Bool results are kept apart, unlike the bits of a std::vector<bool>.
+    auto valid = ParseCsvParallel(
+        Pad(lines + "x,n\n"), [](CsvReader& r) {
+            std::vector<int64_t> ids;
+            while (r.Batch(1000, ids)) { }
+            std::vector<std::string_view> fields;
+            return !r.Next(fields);
+        },
+        16);
+    assert(valid.size() == 16 && std::count(valid.begin(), valid.end(), false) == 1 && valid.back() == false);
+}
+
+void TestExpr()
+{
+    Expr e;
+    assert(e.Compile(Pad("(6-1)*4*2+(1+3)*(16/2)")));
+    assert(e.Eval(nullptr) == 72);
+    // Left associative, unlike Example_Expr.
+    assert(e.Compile(Pad("10 - 4 - 3 + 8 / 4 / 2")));
+    assert(e.Eval(nullptr) == 4);
+    assert(e.Compile(Pad(" -x * -(y - 0.5) / 2 "), { "x", "y" }));
+    double v[] = { 3, 1.5 };
+    assert(e.Eval(v) == 1.5);
+    assert(e.Vars() == 2);
+
+    assert(e.Compile(Pad("a * a - b / 4 + 1"), { "a", "b" }));
+    std::vector<double> rows, as, bs, out(1000);
+    for (int i = 0; i < 1000; i++) {
+        rows.push_back(i * 0.5);
+        rows.push_back(i);
+        as.push_back(i * 0.5);
+        bs.push_back(i);
+    }
+    e.Eval(rows.data(), 1000, out.data());
+    for (int i = 0; i < 1000; i++) {
+        assert(out[i] == i * 0.5 * (i * 0.5) - i / 4.0 + 1);
+    }
+    const double* columns[] = { as.data(), bs.data() };
+    std::vector<double> out2(1000);
+    e.Eval(columns, 1000, out2.data());
+    assert(out == out2);
+
+    std::string deep = std::string(200, '(') + "x" + std::string(200, ')');
+    for (int i = 0; i < 50; i++) {
+        deep = "x+x*(" + deep + ")";
+    }
+    assert(e.Compile(Pad(deep), { "x" }));
+    double one = 1;
+    assert(e.Eval(&one) == 51);
+    assert(e.Compile(Pad(std::string(300, '(') + "1" + std::string(300, ')'))) == false);
+    // The deepest nesting keeps the most operands on the stack.
+    std::string max = "x+x*x";
+    for (int i = 0; i < 256; i++) {
+        max = "x+x*(" + max + ")";
+    }
+    assert(e.Compile(Pad(max), { "x" }));
+    assert(e.Eval(&one) == 258);
+
+    assert(e.Compile(Pad("1 +\n 2 * z"), { "x" }) == false);
+    assert(e.Error().line == 2 && e.Error().column == 6);
+    assert(std::isnan(e.Eval(nullptr)));
+    assert(e.Compile(Pad("(1 + 2")) == false);
+    assert(e.Compile(Pad("1 2")) == false);
+    assert(e.Compile(Pad("")) == false);
+}
+
 void TestBack()
 {
-    Parser p("Hi");
+    Parser p(Pad("Hi"));
     auto m = p.Mark();
     p.Advance(2);
     p.Back(m);
@@ -563,21 +1641,40 @@ void TestBack()
 
 void TestToken()
 {
-    Parser p("HelloWorld");
+    Parser p(Pad("HelloWorld"));
     auto m = p.Mark();
     p.Advance(5);
     assert(p.Token(m) == "Hello");
 }
 
+void TestPos()
+{
+    static_assert(sizeof(Pos) == 4);
+    Parser p(Pad("Hello World"));
+    p.Advance(6);
+    auto m = p.Mark<Pos>();
+    assert(m.offset == 6);
+    assert(p.View(m) == p.Mark());
+    assert(!p.Moved(m));
+    p.Advance(3);
+    assert(p.Moved(m));
+    assert(p.Token(m) == "Wor");
+    p.Back(m);
+    assert(p.Tail() == "World");
+    assert(p.Token(Pos { 0 }) == "Hello ");
+    p.Advance(5);
+    assert(p.Token(m) == "World");
+}
+
 void TestTail()
 {
-    Parser p("Hi");
+    Parser p(Pad("Hi"));
     assert(p.Tail() == "Hi");
 }
 
 void TestNext()
 {
-    Parser p("Hi");
+    Parser p(Pad("Hi"));
     p.Next();
     assert(p.Tail() == "i");
     p.Next();
@@ -586,17 +1683,360 @@ void TestNext()
 
 void TestCurr()
 {
-    Parser a("A");
+    Parser a(Pad("A"));
     assert(a.Curr() == 'A');
-    Parser b("");
+    Parser b(Pad(""));
     assert(b.Curr() == '\0');
 }
 
+void TestStreamParser()
+{
+    std::istringstream in("point 12 -7.5 \"a\\\"b\"\n"
+                          "vector 30 4e1 \"\"\n"
+                          "end");
+    StreamParser p(in, 3);
+
+    std::vector<std::string> names;
+    std::vector<double> values;
+    std::vector<std::string> strings;
+    while (p.More()) {
+        auto m = p.Mark();
+        if (p.While({ 'a', 'z' }) && p.Equal(' ')) {
+            names.emplace_back(p.Token(m));
+            p.Space();
+            int x;
+            double y;
+            assert(p.Number(x) && p.Space() && p.Number(y) && p.Space());
+            values.push_back(x);
+            values.push_back(y);
+            auto s = p.Mark();
+            assert(p.String('"'));
+            strings.emplace_back(p.Token(s));
+        }
+        p.Line();
+    }
+    assert(names == (std::vector<std::string> { "point", "vector" }));
+    assert(values == (std::vector<double> { 12, -7.5, 30, 40 }));
+    assert(strings == (std::vector<std::string> { R"("a\"b")", R"("")" }));
+
+    std::istringstream big(std::string(100000, 'x') + "\nend");
+    StreamParser q(big, 64);
+    assert(q.Until('\n') == true);
+    assert(q.Offset() == 100000);
+    assert(q.Buffered() <= 128);
+    auto m = q.Mark();
+    assert(q.Match("\nen") == true);
+    assert(q.Equal("dx") == false);
+    assert(q.Match('d') == true);
+    assert(q.More() == false);
+    assert(q.Token(m) == "\nend");
+    q.Back(m);
+    assert(q.Tail() == "\nend");
+    assert(q.Line() == true);
+    assert(q.Line() == true);
+    assert(q.Tail() == "");
+    assert(q.Line() == false);
+
+    std::istringstream quoted(R"("one \"two\" three" x)");
+    StreamParser r(quoted, 4);
+    std::string out;
+    assert(r.String('"', out) == true);
+    assert(out == R"(one "two" three)");
+    assert(r.Match(" x") == true);
+
+    // Long strings are read across many chunks, with escapes split
+    // between them.
+    std::string body;
+    for (int i = 0; i < 20000; i++) {
+        body += i % 7 ? "ab" : "\\\"\\u00e9";
+    }
+    std::istringstream longer("\"" + body + "\" x \"" + body + "\"\"");
+    StreamParser l(longer, 5);
+    auto start = l.Mark();
+    assert(l.String('"') && l.Token(start).size() == body.size() + 2);
+    assert(l.Match(" x ") && l.String('"', out) && l.More() && l.Curr() == '"');
+    std::string unescaped;
+    assert(Parser(Pad("\"" + body + "\"")).String('"', unescaped) && out == unescaped);
+    assert(l.String('"') == false && l.String('"', out) == false && out.empty());
+
+    // A number ends at the comma, without reading the rest of the line.
+    std::string line = "12,-3";
+    for (int i = 0; i < 1000; i++) {
+        line += ",4";
+    }
+    size_t read = 0;
+    StreamParser n([&](char* buf, size_t size) {
+        size = std::min(size, line.size() - read);
+        std::copy_n(line.data() + read, size, buf);
+        read += size;
+        return size;
+    },
+        4);
+    int a, b;
+    assert(n.Number(a) && n.Match(',') && n.Number(b) && n.Equal(','));
+    assert(a == 12 && b == -3);
+    assert(read <= 8);
+}
+
+void TestMappedParser()
+{
+    std::ofstream("walker_test.txt") << "point(1 20)\nvector(-2 -30)";
+
+    MappedParser p("walker_test.txt", true);
+    assert(p.Ok() == true);
+    auto m = p.Mark();
+    assert(p.Line() == true);
+    assert(p.Token(m) == "point(1 20)\n");
+    assert(p.Tail() == "vector(-2 -30)");
+
+    std::ofstream("walker_test.txt");
+    MappedFile empty("walker_test.txt");
+    assert(empty.Ok() == true);
+    assert(empty.Text() == "");
+    std::remove("walker_test.txt");
+
+    MappedParser missing("walker_test.txt");
+    assert(missing.Ok() == false);
+    assert(missing.More() == false);
+}
+
+void TestUtf8()
+{
+    std::vector<const scan::Backend*> backends = { &scan::Scalar };
+#ifdef WALKER_X86
+    backends.push_back(&scan::Sse2);
+    if (__builtin_cpu_supports("avx2")) {
+        backends.push_back(&scan::Avx2);
+    }
+#endif
+    // Each invalid sequence, alone and after 40 valid characters,
+    // so the vector kernels meet it inside and across their blocks.
+    std::vector<std::string> invalid = {
+        "\x80", "\xBF", "\xC0\x80", "\xC1\xBF", "\xC2", "\xC2\x41", "\xE0\x80\x80", "\xE0\x9F\xBF",
+        "\xE1\x80", "\xED\xA0\x80", "\xED\xBF\xBF", "\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF",
+        "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xF8\x88\x80\x80\x80", "\xFF", "\xE2\x82\xAC\x80",
+    };
+    std::string valid = "a\xC2\xA9\xE2\x82\xAC\xED\x9F\xBF\xEE\x80\x80\xF0\x9F\x98\x80\xF4\x8F\xBF\xBF";
+    for (auto b : backends) {
+        for (size_t pad = 0; pad < 40; pad++) {
+            auto prefix = std::string(pad, 'x') + valid;
+            for (auto& bad : invalid) {
+                auto text = prefix + bad + std::string(70, 'y');
+                auto p = b->findInvalidUtf8(text.data(), text.data() + text.size());
+                auto want = bad == "\xE2\x82\xAC\x80" ? prefix.size() + 3 : prefix.size();
+                assert_msg(size_t(p - text.data()) == want, b->name);
+            }
+            auto text = prefix + prefix + prefix;
+            assert_msg(b->findInvalidUtf8(text.data(), text.data() + text.size()) == text.data() + text.size(), b->name);
+            // Cut inside the last character.
+            assert_msg(b->findInvalidUtf8(text.data(), text.data() + text.size() - 1) == text.data() + text.size() - 4, b->name);
+        }
+        // Valid characters with a few random bytes among them.
+        static const char* chars[] = { "a", " ", "\xC2\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80" };
+        uint32_t seed = 1;
+        for (int i = 0; i < 2000; i++) {
+            std::string text;
+            for (int j = 0; j < 200; j++) {
+                seed = seed * 1103515245 + 12345;
+                auto r = seed >> 16;
+                text += r % 500 == 0 ? std::string(1, char(r >> 9)) : chars[r % 5];
+            }
+            auto e = text.data() + text.size();
+            assert_msg(b->findInvalidUtf8(text.data(), e) == scan::Scalar.findInvalidUtf8(text.data(), e), b->name);
+        }
+    }
+
+    uint32_t code;
+    Parser p(Pad(valid));
+    assert(p.ValidUtf8() == true);
+    assert(p.AnyRune(code) && code == 'a');
+    assert(p.AnyRune(code) && code == 0xA9);
+    assert(p.MatchRune(0x20AC) == true);
+    assert(p.MatchRune(0x20AC) == false);
+    assert(p.AnyRune(code) && code == 0xD7FF);
+    assert(p.AnyRune() && p.AnyRune(code) && code == 0x1F600);
+    assert(p.AnyRune(code) && code == 0x10FFFF);
+    assert(p.AnyRune() == false);
+
+    std::string bad = "ok \xC3\xA9t\xC3";
+    p = Parser(Pad(bad));
+    assert(p.ValidUtf8() == false);
+    assert(p.Tail() == bad);
+    assert(p.Offset(p.Failure()) == bad.size() - 1);
+    p.Advance(bad.size() - 1);
+    assert(p.AnyRune() == false);
+
+    // Latin letters, Greek and Cyrillic.
+    UnicodeClass letters = UnicodeClass({ { 'a', 'z' }, { 'A', 'Z' }, { 0xC0, 0xFF } })
+        | UnicodeClass({ { 0x391, 0x3C9 }, { 0x400, 0x4FF } });
+    assert(letters.Has('q') && letters.Has(0xE9) && letters.Has(0x3B1) && letters.Has(0x4FF));
+    assert(!letters.Has('1') && !letters.Has(0x3CA) && !letters.Has(0x500) && !letters.Has(0x10000));
+    assert(UnicodeClass({ { 0x100, 0x1FF }, { 0x80, 0x100 }, { 0x300, 0x3FF }, { 0x200, 0x2FF } }).Has(0x250));
+    std::string words = "caf\xC3\xA9 \xCE\xB1\xCE\xB2\xCE\xB3, \xD0\xB4\xD0\xB0 x\xE2\x82\xAC";
+    p = Parser(Pad(words));
+    std::vector<std::string_view> found;
+    while (p.More()) {
+        auto m = p.Mark();
+        if (p.While(letters)) {
+            found.push_back(p.Token(m));
+        } else {
+            p.AnyRune();
+        }
+    }
+    assert(found == (std::vector<std::string_view> { "caf\xC3\xA9", "\xCE\xB1\xCE\xB2\xCE\xB3", "\xD0\xB4\xD0\xB0", "x" }));
+    p = Parser(Pad("\xC3\xA9!"));
+    assert(p.Match(letters) && p.Tail() == "!");
+    assert(p.Match(letters) == false);
+}
+
+void TestPadded()
+{
+    PaddedString text("a,b\n1,\"x\"");
+    assert(text.View() == "a,b\n1,\"x\"");
+    assert(text.View().data()[text.View().size() + PaddedString::padding - 1] == '\0');
+    assert(PaddedString().View() == "");
+
+    // The end reads as '\0', but nothing matches there, not even '\0'.
+    Parser p(std::string_view(text).substr(0, 3));
+    p.Advance(3);
+    assert(p.Curr() == '\0');
+    assert(p.Equal('\0') == false);
+    assert(p.Equal('\0', '\n') == false);
+    assert(p.Equal({ '\0', '\x7F' }) == false);
+    assert(p.Match('\n') == false);
+    assert(p.Not('\n') == false);
+    // An empty view may have no data at all.
+    Parser empty { std::string_view() };
+    assert(empty.Curr() == '\0' && empty.Equal('a') == false && empty.Until('a') == false);
+
+    // Views that end before the text see none of what follows them.
+    std::string lines;
+    for (int i = 0; i < 100; i++) {
+        lines += std::to_string(i) + (i % 3 ? "," : "\n");
+    }
+    PaddedString padded(lines);
+    for (size_t n = 0; n < lines.size(); n++) {
+        auto view = padded.View().substr(0, n);
+        Parser p(view);
+        p.Until('\n');
+        assert(p.Tail() == view.substr(std::min(view.find('\n'), n)));
+        CsvReader r(view);
+        std::vector<std::string_view> fields;
+        size_t count = 0;
+        while (r.Next(fields)) {
+            count += fields.size();
+        }
+        assert(count == size_t(std::count(view.begin(), view.end(), ',') + std::count(view.begin(), view.end(), '\n') + (n && view.back() != '\n')));
+    }
+
+    // StreamParser pads its buffer after every read.
+    std::istringstream in(lines);
+    StreamParser stream(in, 64);
+    while (stream.Line()) {
+        auto tail = stream.Tail();
+        assert(tail.data()[tail.size() + PaddedString::padding - 1] == '\0');
+    }
+}
+
+void TestSplit()
+{
+    auto chunks = Split(Pad("a\nbb\nccc\ndddd\n"), 3);
+    assert(chunks == (std::vector<std::string_view> { "a\nbb\n", "ccc\n", "dddd\n" }));
+
+    chunks = Split(Pad("one long line\nx"), 4);
+    assert(chunks == (std::vector<std::string_view> { "one long line\n", "x" }));
+
+    chunks = Split(Pad("a;b;c"), 10, ';');
+    assert(chunks == (std::vector<std::string_view> { "a;", "b;", "c" }));
+
+    assert(Split(Pad(""), 4).empty());
+
+    chunks = Split(Pad("a\nb\n"), 0);
+    assert(chunks == (std::vector<std::string_view> { "a\nb\n" }));
+}
+
+void TestParseParallel()
+{
+    std::string text;
+    for (int i = 1; i <= 10000; i++) {
+        text += "n " + std::to_string(i) + "\n";
+    }
+    auto sums = ParseParallel(
+        Pad(text), [](Parser& p) {
+            int64_t sum = 0, n;
+            while (p.Match("n ") && p.Number(n) && p.Line()) {
+                sum += n;
+            }
+            return p.More() ? -1 : sum;
+        },
+        16);
+    assert(sums.size() == 16);
+    int64_t total = 0;
+    for (auto s : sums) {
+        assert(s > 0);
+        total += s;
+    }
+    assert(total == 10000 * 10001 / 2);
+
+    // Results need not be default constructible.
+    struct Count {
+        explicit Count(size_t n)
+            : n(n)
+        {
+        }
+        size_t n;
+    };
+    auto counts = ParseParallel(
+        Pad(text), [](Parser& p) {
+            size_t n = 0;
+            while (p.Line()) {
+                n++;
+            }
+            return Count(n);
+        },
+        16);
+    size_t lines = 0;
+    for (auto& c : counts) {
+        lines += c.n;
+    }
+    assert(lines == 10000);
+
+    // Without a number of chunks, each hardware thread gets one.
+    counts = ParseParallel(Pad(text), [](Parser& p) {
+        size_t n = 0;
+        while (p.Line()) {
+            n++;
+        }
+        return Count(n);
+    });
+    lines = 0;
+    for (auto& c : counts) {
+        lines += c.n;
+    }
+    assert(!counts.empty() && lines == 10000);
+
+    // An exception of one chunk is rethrown after all threads finish.
+    std::string error;
+    try {
+        ParseParallel(
+            Pad(text), [](Parser& p) {
+                if (p.Tail().find("\nn 5000\n") != std::string_view::npos) {
+                    throw std::runtime_error("bad chunk");
+                }
+                return 0;
+            },
+            16);
+    } catch (const std::runtime_error& e) {
+        error = e.what();
+    }
+    assert(error == "bad chunk");
+}
+
 void TestMore()
 {
-    Parser a("A");
+    Parser a(Pad("A"));
     assert(a.More() == true);
-    Parser b("");
+    Parser b(Pad(""));
     assert(b.More() == false);
 }
 
@@ -605,12 +2045,20 @@ int main()
     Example_Expr();
     Example_Json();
     Example();
+    TestMemo();
+    TestMemo_Edit();
     TestString();
+    TestString_Unescape();
     TestPeek();
     TestUndo();
     TestOut();
+    TestTokens();
+    TestTree();
     TestNumber_Float();
     TestNumber_Int();
+    TestNumber_Wide();
+    TestNumber_Digits();
+    TestNumber_View();
     TestFloat();
     TestInteger();
     TestLine();
@@ -618,20 +2066,38 @@ int main()
     TestNot();
     TestAny();
     TestUntil_Str();
+    TestPatterns();
     TestUntil_Range();
     TestUntil();
+    TestScan();
     TestWhile();
+    TestCharSet();
     TestMatch_Range();
     TestMatch_Str();
     TestMatch_Char();
     TestEqual_Range();
     TestEqual_Str();
     TestEqual_Char();
+    TestFailure();
+    TestLocate();
+    TestProfile();
+    TestGrammar();
+    TestJson();
+    TestJsonCursor();
+    TestCsv();
+    TestExpr();
     TestBack();
     TestToken();
+    TestPos();
     TestTail();
     TestNext();
     TestCurr();
     TestMore();
+    TestStreamParser();
+    TestMappedParser();
+    TestPadded();
+    TestUtf8();
+    TestSplit();
+    TestParseParallel();
     return 0;
 }
@@ -1,14 +1,383 @@
 #ifndef WALKER_HPP
 #define WALKER_HPP
 
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <set>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#ifdef WALKER_PROFILE
+#include <deque>
+#include <mutex>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define WALKER_X86
+#endif
+
+// Scanning kernels used by the parser to skip runs of characters.
+// Each kernel returns a pointer to the first character in [p, e)
+// that stops the scan, or e if there is none.
+// If WALKER_PADDED is defined, the last vector may read past e into
+// the padding instead of finishing one character at a time.
+namespace scan {
+// Finds the given character.
+const char* Find(const char* p, const char* e, char a);
+// Finds any given character.
+const char* Find(const char* p, const char* e, char a, char b);
+// Finds a character in the given range.
+const char* FindIn(const char* p, const char* e, char lo, char hi);
+// Finds a character not in the given range.
+const char* FindNotIn(const char* p, const char* e, char lo, char hi);
+
+// Sets bit j of out[i] if character j of the 64 at p is chars[i],
+// for the n given characters.
+void Masks(const char* p, const char* chars, size_t n, uint64_t* out);
+
+// Lookup tables of a set of characters, built by CharSet.
+struct Table {
+    bool has[256] = {};
+    // A character is in the set if the masks of its low and high
+    // nibbles intersect. Only built if the set needs at most 8 masks.
+    uint8_t lows[16] = {};
+    uint8_t highs[16] = {};
+    bool nibbles = false;
+};
+// Finds a character in the set.
+const char* FindIn(const char* p, const char* e, const Table& set);
+// Finds a character not in the set.
+const char* FindNotIn(const char* p, const char* e, const Table& set);
+
+// Finds the first byte that does not start a valid UTF-8 sequence:
+// a lone or extra continuation byte, a sequence cut short, an overlong
+// encoding, a surrogate or a code point above U+10FFFF.
+const char* FindInvalidUtf8(const char* p, const char* e);
+// Decodes the UTF-8 sequence at p into its code point and returns its
+// end, or returns p if the sequence is invalid or cut short by e.
+const char* Decode(const char* p, const char* e, uint32_t& code);
+
+// A set of kernels implemented with one instruction set.
+struct Backend {
+    const char* name;
+    const char* (*find)(const char*, const char*, char);
+    const char* (*find2)(const char*, const char*, char, char);
+    const char* (*findIn)(const char*, const char*, char, char);
+    const char* (*findNotIn)(const char*, const char*, char, char);
+    const char* (*findSet)(const char*, const char*, const Table&);
+    const char* (*findNotSet)(const char*, const char*, const Table&);
+    void (*masks)(const char*, const char*, size_t, uint64_t*);
+    const char* (*findInvalidUtf8)(const char*, const char*);
+};
+
+// Portable one character at a time kernels.
+extern const Backend Scalar;
+#ifdef WALKER_X86
+extern const Backend Sse2;
+extern const Backend Avx2;
+#endif
+// Returns the best backend supported by the running CPU.
+const Backend& Best();
+// Returns the backend used by the parser.
+const Backend& Active();
+// Sets the backend used by the parser.
+void Use(const Backend&);
+}
+
+// Set of characters. Testing a character is a single table lookup.
+class CharSet {
+public:
+    // Creates a set from a spec such as "a-zA-Z_",
+    // where x-y is the range of characters from x to y.
+    constexpr CharSet(std::string_view spec);
+    // Creates a set from the given character ranges.
+    constexpr CharSet(std::initializer_list<std::pair<char, char>> ranges);
+
+    // Tells if the character is in the set.
+    constexpr bool Has(char c) const;
+    // Returns the union of the sets.
+    constexpr CharSet operator|(const CharSet&) const;
+    // Returns the characters that are not in the set.
+    constexpr CharSet operator~() const;
+
+    // Returns the lookup tables of the set for the scan kernels.
+    constexpr const scan::Table& Table() const;
+
+private:
+    constexpr CharSet() = default;
+    constexpr void Add(char lo, char hi);
+    // Builds the nibble masks used by the vector kernels.
+    constexpr void Index();
+
+    scan::Table table;
+};
+
+// Set of Unicode code points, for matching UTF-8 text.
+// ASCII characters are kept in a CharSet, so runs of them are skipped
+// with the scan kernels, and others in sorted ranges.
+class UnicodeClass {
+public:
+    // Creates a class from the given ranges of code points.
+    UnicodeClass(std::initializer_list<std::pair<uint32_t, uint32_t>> ranges);
+
+    // Tells if the code point is in the class.
+    bool Has(uint32_t code) const;
+    // Returns the union of the classes.
+    UnicodeClass operator|(const UnicodeClass&) const;
+    // Returns the ASCII characters of the class.
+    const CharSet& Ascii() const;
+
+private:
+    void Add(uint32_t lo, uint32_t hi);
+
+    CharSet ascii = CharSet("");
+    // Disjoint ranges above U+007F, sorted.
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+};
+
+// Line and column of a position in the text, both starting at 1.
+struct Location {
+    size_t line;
+    size_t column;
+};
+
+// Compact mark: the offset of a position from the start of the text
+// given to the parser. Takes 4 bytes instead of the 16 of a view, for
+// tables of positions, so the text must be smaller than 4 GiB.
+struct Pos {
+    uint32_t offset;
+
+    bool operator==(const Pos&) const = default;
+};
+
+// Copy of a text followed by padding bytes.
+// Defining WALKER_PADDED promises that every text given to a parser is
+// followed by at least padding readable bytes, which lets the scanning
+// kernels load whole vectors at the end of the text. Views into a
+// padded string, such as its lines, keep the promise.
+// Only the kernels use the padding. Primitives that read one
+// character, such as Curr and Equal, still check the end, as the byte
+// after a view may be more text rather than padding.
+class PaddedString {
+public:
+    static constexpr size_t padding = 64;
+
+    PaddedString(std::string_view text = {});
+
+    // Returns the text without the padding.
+    std::string_view View() const;
+    operator std::string_view() const;
+
+private:
+    std::string data;
+};
+
+// Compact array of tokens stored as offsets into the text.
+// Each token takes 9 bytes in three parallel arrays, and clearing
+// the array keeps its memory, so tokenizing again does not allocate.
+// Offsets are 32 bits, so the text must be smaller than 4 GiB.
+class Tokens {
+public:
+    // Returns the number of tokens.
+    size_t Size() const;
+    // Removes all tokens, keeping the memory for reuse.
+    void Clear();
+    // Reserves memory for n tokens.
+    void Reserve(size_t n);
+    // Returns the offset of the token from the start of the text.
+    uint32_t Offset(size_t i) const;
+    // Returns the length of the token.
+    uint32_t Length(size_t i) const;
+    // Returns the kind of the token.
+    uint8_t Kind(size_t i) const;
+    // Returns the text of the token.
+    std::string_view View(size_t i) const;
+    // Appends a token of the given kind.
+    void Push(uint32_t offset, uint32_t length, uint8_t kind);
+
+private:
+    friend class Parser;
+
+    std::string_view text;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> lengths;
+    std::vector<uint8_t> kinds;
+};
+
+// Syntax tree built by a parser with Open and Close, stored in flat
+// arrays like Tokens, so adding a node only appends to them.
+// Nodes are stored after their descendants, which are the contiguous
+// range from First(i) to i. The last child of a node is the node before
+// it, and the sibling before a node is the node before its First.
+// Clearing the tree keeps its memory.
+class Tree {
+public:
+    // Returns the number of nodes.
+    size_t Size() const;
+    // Removes all nodes, keeping the memory for reuse.
+    void Clear();
+    // Reserves memory for n nodes.
+    void Reserve(size_t n);
+    // Returns the kind of the node.
+    uint16_t Kind(size_t i) const;
+    // Returns the positions where the node starts and ends.
+    Pos Start(size_t i) const;
+    Pos End(size_t i) const;
+    // Returns the text of the node.
+    std::string_view View(size_t i) const;
+    // Returns the index of the first descendant of the node,
+    // or of the node itself if it has none.
+    size_t First(size_t i) const;
+    // Outputs the indexes of the children of the node, in order.
+    void Children(size_t i, std::vector<size_t>& out) const;
+
+private:
+    friend class Parser;
+
+    // Drops the nodes from the index on.
+    void Truncate(size_t n);
+    // Drops the nodes that end past the offset.
+    void Rewind(uint32_t offset);
+
+    std::string_view text;
+    std::vector<uint16_t> kinds;
+    std::vector<uint32_t> starts;
+    std::vector<uint32_t> ends;
+    std::vector<uint32_t> firsts;
+    // Nodes opened and not closed yet, innermost last.
+    struct Pending {
+        uint16_t kind;
+        uint32_t start;
+        uint32_t first;
+    };
+    std::vector<Pending> open;
+};
+
+// Precompiled set of strings to search for at once.
+// Builds an Aho-Corasick automaton over the byte classes used by
+// the patterns, so finding any of them is a single pass over the text.
+// Empty patterns never match.
+class Patterns {
+public:
+    Patterns(std::initializer_list<std::string_view> patterns);
+    Patterns(const std::vector<std::string_view>& patterns);
+
+    // Returns the number of patterns.
+    size_t Size() const;
+    // Returns the pattern with the given index.
+    std::string_view Pattern(size_t i) const;
+    // Tells if a pattern starts with the character.
+    bool Starts(char c) const;
+
+private:
+    friend class Parser;
+
+    // Finds the start of the leftmost pattern, or returns e.
+    const char* Find(const char* p, const char* e) const;
+    // Returns the index of the longest pattern at p, or Size().
+    size_t Longest(const char* p, const char* e) const;
+
+    std::vector<std::string> patterns;
+    size_t maxLength = 0;
+    // Byte classes and transitions of the automaton, one row per state.
+    uint16_t classes[256] = {};
+    size_t classCount = 1;
+    std::vector<uint32_t> next;
+    std::vector<uint32_t> depth;
+    // Pattern spelled by the path to the state, or Size().
+    std::vector<uint32_t> term;
+    // Longest pattern ending at the state, or Size().
+    std::vector<uint32_t> out;
+    // First bytes of the patterns, to skip text while at the root.
+    // Up to two of them are also listed to use the scan kernels.
+    bool first[256] = {};
+    char firstBytes[2] = {};
+    size_t firstCount = 0;
+};
+
+#ifdef WALKER_PROFILE
+// Counters of the parser primitives and of the rules named with
+// Parser::Profile, kept only when WALKER_PROFILE is defined.
+// Each thread counts on its own; the counts of the threads that
+// finished are added to the others when reporting.
+namespace profile {
+
+struct Counters {
+    std::string_view name;
+    bool rule = false;
+    uint64_t calls = 0;
+    // A primitive succeeds when it advances the parser.
+    uint64_t successes = 0;
+    // Bytes the calls advanced the parser by.
+    uint64_t bytes = 0;
+    // Rewinds by Back, Undo and Peek during the calls, and the bytes
+    // they rewound. Rewinds outside of any call are counted under
+    // the first counters, named "(none)".
+    uint64_t backtracks = 0;
+    uint64_t backtracked = 0;
+};
+
+// Returns the counters of every primitive and rule, the ones that
+// rewound the most bytes first. Counts of threads still parsing
+// may be incomplete.
+std::vector<Counters> Snapshot();
+// Formats the counters as a text table.
+std::string Report();
+// Formats the counters as a JSON array of objects.
+std::string ReportJson();
+// Zeroes the counters of the calling thread and of the finished ones.
+void Reset();
+
+// Returns the id of the counters with the name, adding them if needed.
+uint32_t Id(std::string_view name, bool rule);
+// Returns the name of the counters with the id. It lives as long
+// as the program.
+std::string_view Name(uint32_t id);
+
+// Counts a call while it exists. Calls of primitives made by other
+// primitives count as part of the outer call.
+class Scope {
+public:
+    Scope(uint32_t id, bool primitive, const std::string_view& text);
+    ~Scope();
+    // Sets the outcome of a rule and returns it.
+    bool Done(bool ok);
+
+private:
+    uint32_t id;
+    bool active;
+    bool primitive;
+    int outcome = -1;
+    const std::string_view& text;
+    size_t start;
+};
+
+// Counts a rewind of n bytes under the innermost call.
+void Backtrack(size_t n);
+
+}
+
+#define WALKER_PRIMITIVE(name)                                      \
+    static const uint32_t walkerId = profile::Id(name, false);      \
+    profile::Scope walkerScope(walkerId, true, text)
+#else
+#define WALKER_PRIMITIVE(name)
+#endif
+
 // Text parser.
 class Parser {
 public:
     Parser(const std::string_view text)
-        : text(text) { };
+        : text(text)
+        , base(text) { };
 
     // Convenience function that allows to look ahead.
     // The parser goes back to the mark m on cond either true or false.
@@ -23,12 +392,37 @@ public:
     bool Out(std::string_view m, bool cond, std::string& out);
     bool Out(std::string_view m, bool cond, std::vector<std::string_view>& out);
     bool Out(std::string_view m, bool cond, std::vector<std::string>& out);
+    bool Out(std::string_view m, bool cond, Tokens& out, uint8_t kind = 0);
+    // Builds the nodes opened and closed from now on into the tree.
+    // Back, Undo and Peek drop the nodes that end past the position
+    // they rewind to, so failed alternatives leave no nodes, except
+    // empty ones at that position. Rules replayed by a Memo do not
+    // add their nodes again, so a tree cannot be built with a Memo.
+    void Build(Tree& tree);
+    // Opens a node of the given kind at the current position.
+    // Always returns true, so rules read p.Close(p.Open(kind) && ...).
+    // Does nothing without a tree.
+    bool Open(uint16_t kind);
+    // Closes the last opened node at the current position if cond is
+    // true, with the nodes closed since it was opened as descendants.
+    // Drops it and them otherwise. Returns cond.
+    // Does nothing but return cond without a tree.
+    bool Close(bool cond);
+    // Runs the rule f and returns its outcome. Counts it under the name
+    // when WALKER_PROFILE is defined, and costs nothing otherwise.
+    template <typename F>
+    bool Profile(std::string_view name, F f);
     // Matches a float number and outputs it.
     // Advances the parser if it matches.
+    // Fails without advancing if the number is out of the range of out.
     bool Number(float& out);
+    bool Number(double& out);
     // Matches an integer number and outputs it.
     // Advances the parser if it matches.
+    // Fails without advancing if the number is out of the range of out.
     bool Number(int& out);
+    bool Number(int64_t& out);
+    bool Number(uint64_t& out);
     // Matches a float number.
     // Advances the parser if it matches.
     bool Float();
@@ -38,6 +432,11 @@ public:
     // Matches a string enclosed in quotes. Skips escaped quotes.
     // Advances the parser if it matches.
     bool String(char quote);
+    // Matches a string enclosed in quotes and outputs its contents
+    // with the escapes replaced: \b \f \n \r \t, \uXXXX (as UTF-8)
+    // and a backslash followed by any other character for that character.
+    // Advances the parser if it matches.
+    bool String(char quote, std::string& out);
     // Matches a line (up to a newline character).
     // Advances the parser if it matches.
     bool Line();
@@ -50,6 +449,9 @@ public:
     // Matches any character that is not in the given range.
     // Advances the parser by one character if it does not match.
     bool Not(std::pair<char, char> range);
+    // Matches any character that is not in the set.
+    // Advances the parser by one character if it does not match.
+    bool Not(const CharSet&);
     // Matches a character that is not the given one.
     // Advances the parser by one character if it does not match.
     bool Not(char);
@@ -59,12 +461,25 @@ public:
     // Matches any character.
     // Advances the parser if it matches.
     bool Any();
+    // Matches any UTF-8 encoded character and outputs its code point.
+    // Advances the parser if it matches. Fails on invalid sequences.
+    bool AnyRune();
+    bool AnyRune(uint32_t& out);
+    // Tells if the remaining text is valid UTF-8, checking it with the
+    // scan kernels. Records a failure at the first invalid sequence.
+    bool ValidUtf8();
     // Matches until the given string.
     // Advances the parser if it matches.
     bool Until(std::string_view);
+    // Matches until the leftmost of the patterns.
+    // Advances the parser if it matches.
+    bool Until(const Patterns&);
     // Matches until any given character range.
     // Advances the parser if it matches.
     bool Until(std::pair<char, char> range);
+    // Matches until any character in the set.
+    // Advances the parser if it matches.
+    bool Until(const CharSet&);
     // Matches until the given character.
     // Advances the parser if it matches.
     bool Until(char);
@@ -80,9 +495,25 @@ public:
     bool While(std::pair<char, char>, std::pair<char, char>);
     bool While(std::pair<char, char>, std::pair<char, char>, std::pair<char, char>);
     bool While(std::pair<char, char>, std::pair<char, char>, std::pair<char, char>, std::pair<char, char>);
+    // Matches while in the set.
+    // Advances the parser if it matches.
+    bool While(const CharSet&);
+    // Matches while UTF-8 encoded characters are in the class.
+    // Skips runs of ASCII characters with the scan kernels.
+    // Advances the parser if it matches.
+    bool While(const UnicodeClass&);
     // Matches any given character range.
     // Advances the parser if it matches.
     bool Match(std::pair<char, char> range);
+    // Matches any character in the set.
+    // Advances the parser if it matches.
+    bool Match(const CharSet&);
+    // Matches a UTF-8 encoded character in the class.
+    // Advances the parser if it matches.
+    bool Match(const UnicodeClass&);
+    // Matches the UTF-8 encoding of the code point.
+    // Advances the parser if it matches.
+    bool MatchRune(uint32_t code);
     // Matches the given character.
     // Advances the parser if it matches.
     bool Match(char);
@@ -92,254 +523,1936 @@ public:
     // Matches the given string.
     // Advances the parser if it matches.
     bool Match(std::string_view);
+    // Matches the longest of the patterns and outputs its index.
+    // Advances the parser if it matches.
+    bool Match(const Patterns&);
+    bool Match(const Patterns&, size_t& which);
     // Tests any given character range.
     bool Equal(std::pair<char, char>);
+    // Tests any character in the set.
+    bool Equal(const CharSet&);
     // Tests the given character.
     bool Equal(char);
     // Tests any given character.
     bool Equal(char, char);
     // Tests the given string.
     bool Equal(std::string_view);
-    // Returns a mark to the current position.
-    std::string_view Mark();
+    // Tests the patterns and outputs the index of the longest one.
+    bool Equal(const Patterns&);
+    bool Equal(const Patterns&, size_t& which);
+    // Returns a mark to the current position, as a view of the
+    // remaining text or, with Mark<Pos>(), as an offset.
+    template <typename T = std::string_view>
+    T Mark();
     // Sets the parser to the marked position.
     void Back(std::string_view m);
+    void Back(Pos m);
     // Tells if the parser has moved from the marked position.
     bool Moved(std::string_view m);
+    bool Moved(Pos m);
     // Returns the token from the marked position to the current position.
     std::string_view Token(std::string_view m);
+    std::string_view Token(Pos m);
+    // Returns the view mark of the same position as the offset.
+    std::string_view View(Pos m);
     // Returns the remaining text.
     std::string_view Tail();
-    // Returns the current character.
+    // Returns the offset of the mark from the start of the text.
+    size_t Offset(std::string_view m);
+    // Returns the line and column of the mark.
+    // The first call indexes the lines of the whole text.
+    Location Locate(std::string_view m);
+    // Records that what was expected at the current position.
+    // Always returns false.
+    bool Fail(std::string_view what);
+    // Returns a mark to the furthest position where a match failed.
+    std::string_view Failure();
+    // Returns what was expected at the furthest failure (up to 16 items).
+    // Only failures given to Fail are listed, unless WALKER_EXPECTED is
+    // defined, which makes every failing primitive list its arguments
+    // at some cost to the speed of backtracking.
+    const std::vector<std::string>& Expected();
+    // Returns the current character, or '\0' at the end.
     char Curr();
     // Advances the parser by one characters.
     void Next();
     // Advances the parser by n characters.
-    void Advance(int);
+    void Advance(size_t);
     // Tells if there are more characters to parse.
     bool More();
 
 private:
+    // Advances the parser to the given position in the remaining text.
+    void Seek(const char*);
+    // Scans and converts a number in a single pass.
+    template <typename T>
+    bool ParseInt(T& out);
+    // Converts floats with Clinger's fast path only, and leaves the rest to
+    // std::from_chars, which needs libstdc++ 11 or later for floating point.
+    // There is no Eisel-Lemire step in between.
+    template <typename T>
+    bool ParseFloat(T& out);
+    // Returns the end of the run of digits at p and adds them to v,
+    // which wraps past 19 digits. Checks and converts 8 digits at a time,
+    // loaded as little-endian words.
+    static inline const char* Digits(const char* p, const char* e, uint64_t& v);
+    const char* End();
+    // Finds any given character, looking at the first few characters
+    // before calling the scan kernel, as escapes are often close together.
+    // Inlined, since short strings spend most of their time here.
+    static const char* Find(const char* p, const char* e, char a, char b);
+    // Replaces the escape after a backslash at p and returns its end.
+    const char* Unescape(const char* p, std::string& out);
+    // Appends the UTF-8 encoding of the code point.
+    static void Encode(uint32_t code, std::string& out);
+    // Tells if the character is in the range.
+    static bool In(char c, std::pair<char, char> range);
+    // Matches like Match without recording a failure.
+    bool Accept(char);
+    bool Accept(char, char);
+
     std::string_view text;
+    // The whole text, for offsets and locations.
+    std::string_view base;
+    // Something expected at a failure. Its text is copied into whats,
+    // which keeps its memory across failures, so recording them does
+    // not allocate once it has grown. The kind and the characters are
+    // packed in one word to compare them at once.
+    struct Expect {
+        enum Kind { Name, Literal, Char, Range };
+        uint32_t code;
+        uint32_t at;
+        uint32_t size;
+        Kind kind() const { return Kind(code & 0xFF); }
+        char lo() const { return char(code >> 8); }
+        char hi() const { return char(code >> 16); }
+    };
+    // Records the failure of a primitive.
+    bool Miss(Expect::Kind, char lo, char hi, std::string_view what = {});
+    void Record(Expect::Kind, char lo, char hi, std::string_view what);
+
+    // Offset and the first expectations of the furthest failure.
+    // The expectations are allocated by the first one recorded, so
+    // parsers that never fail with a name stay small.
+    static constexpr size_t maxExpects = 16;
+    size_t failure = 0;
+    std::vector<Expect> expects;
+    std::string whats;
+    std::vector<std::string> expected;
+    // Offsets of the newlines of the text, built on demand.
+    std::vector<size_t> lines;
+    bool indexed = false;
+    // Smallest remaining size the parser looked at, either by rewinding
+    // from it or by failing there. Tracked for the rules of a Memo.
+    size_t reach = SIZE_MAX;
+    // Tree given to Build, if any.
+    Tree* tree = nullptr;
+
+    friend class Memo;
 };
 
-bool Parser::Out(std::string_view m, bool cond, std::string_view& out)
+// Packrat memo table for backtracking grammars.
+// Remembers whether a rule matched at a position and where it stopped,
+// so alternations that try the same rule again at the same position
+// replay the outcome instead of parsing again.
+// A replayed rule does not repeat its side effects, such as outputs
+// or the nodes of a Tree.
+//
+// Also reparses edited texts incrementally: after Edit, parsing the new
+// text replays the rules that did not look at the edited characters,
+// so only the rules around the edit run again.
+class Memo {
+public:
+    // Rules are assumed to look at most lookahead characters past the
+    // furthest position they rewound from or failed at, as when
+    // matching a string of that length.
+    explicit Memo(size_t lookahead = 16);
+
+    // Runs the rule f with the given id at the current position,
+    // or replays its outcome if it already ran there.
+    template <typename F>
+    bool Run(Parser& p, uint16_t rule, F f);
+    // Forgets every outcome. Must be called before parsing another text,
+    // unless it is an edit of the text given to Edit.
+    void Clear();
+    // Keeps the outcomes that still hold after replacing removed
+    // characters at offset with inserted ones, in a text of the given
+    // size before the edit. Forgets the rules that looked at the
+    // replaced characters, or at the point of an insertion.
+    // Takes time in the outcomes it forgets, plus the ones between
+    // this edit and the previous one.
+    // The inserted length only checks that each edit applies to the
+    // text left by the previous one.
+    void Edit(size_t size, size_t offset, size_t removed, size_t inserted);
+
+private:
+    struct Entry {
+        bool ok;
+        size_t length;
+        // Characters the rule looked at, without the lookahead.
+        size_t examined;
+    };
+    static uint64_t Key(size_t at, uint64_t rule);
+    // The table is split at the last edit. The positions before it are
+    // keyed by offset and the ones after it by the size of the remaining
+    // text, so the edit changes neither. Edit first moves the split to
+    // the new edit.
+    size_t split = SIZE_MAX;
+    std::unordered_map<uint64_t, Entry> front;
+    std::unordered_map<uint64_t, Entry> back;
+    // Offset where each rule of the front stops looking, and its key,
+    // in order. The rules that reach an edit are the last ones, and
+    // they include the ones that start after it.
+    std::set<std::pair<size_t, uint64_t>> reaches;
+    // Keys of the back in order, the ones furthest from the end last.
+    std::set<uint64_t> backs;
+    size_t lookahead;
+    // Size of the text after the last edit.
+    size_t edited = SIZE_MAX;
+};
+
+namespace scan {
+
+// Ranges are compared as signed characters, like Parser::Equal does
+// on targets where char is signed. Flipping the top bit maps unsigned
+// chars onto the same order.
+constexpr char bias = std::is_signed_v<char> ? 0 : char(0x80);
+
+#ifdef WALKER_PADDED
+// Returns a mask of the characters from p that are before e, for the
+// last vector of a text, which reads into the padding.
+inline unsigned Below(const char* p, const char* e)
 {
-    if (cond) {
-        out = Token(m);
-    }
-    return cond;
+    return (1u << (e - p)) - 1;
 }
+#endif
 
-bool Parser::Out(std::string_view m, bool cond, std::string& out)
+const char* ScalarFind(const char* p, const char* e, char a)
 {
-    if (cond) {
-        out = Token(m);
+    while (p != e && *p != a) {
+        p++;
     }
-    return cond;
+    return p;
 }
 
-bool Parser::Out(std::string_view m, bool cond, std::vector<std::string_view>& out)
+const char* ScalarFind2(const char* p, const char* e, char a, char b)
 {
-    if (cond) {
-        out.push_back(Token(m));
+    while (p != e && *p != a && *p != b) {
+        p++;
     }
-    return cond;
+    return p;
 }
 
-bool Parser::Out(std::string_view m, bool cond, std::vector<std::string>& out)
+const char* ScalarFindIn(const char* p, const char* e, char lo, char hi)
 {
-    if (cond) {
-        out.push_back(std::string(Token(m)));
+    while (p != e && (*p < lo || *p > hi)) {
+        p++;
     }
-    return cond;
+    return p;
 }
 
-bool Parser::Peek(std::string_view m, bool cond)
+const char* ScalarFindNotIn(const char* p, const char* e, char lo, char hi)
 {
-    Back(m);
-    return cond;
+    while (p != e && *p >= lo && *p <= hi) {
+        p++;
+    }
+    return p;
 }
 
-bool Parser::Undo(std::string_view m, bool cond)
+const char* ScalarFindSet(const char* p, const char* e, const Table& set)
 {
-    if (!cond) {
-        Back(m);
+    while (p != e && !set.has[(unsigned char)*p]) {
+        p++;
     }
-    return cond;
+    return p;
 }
 
-bool Parser::Number(float& out)
+const char* ScalarFindNotSet(const char* p, const char* e, const Table& set)
 {
-    auto m = Mark();
-    if (Float()) {
-        out = atof(m.data());
-        return true;
+    while (p != e && set.has[(unsigned char)*p]) {
+        p++;
     }
-    return false;
+    return p;
 }
 
-bool Parser::Number(int& out)
+void ScalarMasks(const char* p, const char* chars, size_t n, uint64_t* out)
 {
-    auto m = Mark();
-    if (Integer()) {
-        out = atoi(m.data());
-        return true;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = 0;
+        for (int j = 0; j < 64; j++) {
+            out[i] |= uint64_t(p[j] == chars[i]) << j;
+        }
     }
-    return false;
 }
 
-bool Parser::Float()
+const char* Decode(const char* p, const char* e, uint32_t& code)
 {
-    auto m = Mark();
-    Match('-', '+');
-    auto n = Mark();
-    if (Match('.') && !While({ '0', '9' })) {
-        Back(m);
-        return false;
+    if (p == e) {
+        return p;
     }
-    if (While({ '0', '9' }) && Match('.') && While({ '0', '9' })) { }
-    if (Match('e', 'E')) {
-        Match('-', '+');
-        if (!While({ '0', '9' })) {
-            Back(m);
-            return false;
+    auto c = (unsigned char)*p;
+    if (c < 0x80) {
+        code = c;
+        return p + 1;
+    }
+    // Length, bits of the lead byte and smallest code point by length.
+    size_t n;
+    uint32_t min;
+    if ((c & 0xE0) == 0xC0) {
+        n = 2;
+        code = c & 0x1F;
+        min = 0x80;
+    } else if ((c & 0xF0) == 0xE0) {
+        n = 3;
+        code = c & 0x0F;
+        min = 0x800;
+    } else if ((c & 0xF8) == 0xF0) {
+        n = 4;
+        code = c & 0x07;
+        min = 0x10000;
+    } else {
+        return p;
+    }
+    if (size_t(e - p) < n) {
+        return p;
+    }
+    for (size_t i = 1; i < n; i++) {
+        auto b = (unsigned char)p[i];
+        if ((b & 0xC0) != 0x80) {
+            return p;
         }
+        code = code << 6 | (b & 0x3F);
     }
-    if (Moved(n)) {
-        return true;
+    if (code < min || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF)) {
+        return p;
     }
-    Back(m);
-    return false;
+    return p + n;
 }
 
-bool Parser::Integer()
+const char* ScalarFindInvalidUtf8(const char* p, const char* e)
 {
-    return Undo(Mark(), (Match('-', '+') || true) && While({ '0', '9' }));
+    while (p != e) {
+        // Skips ASCII 8 characters at a time.
+        uint64_t x;
+        if (e - p >= 8 && (std::memcpy(&x, p, 8), (x & 0x8080808080808080) == 0)) {
+            p += 8;
+            continue;
+        }
+        uint32_t code;
+        auto q = Decode(p, e, code);
+        if (q == p) {
+            return p;
+        }
+        p = q;
+    }
+    return e;
 }
 
-bool Parser::String(char quote)
+// Returns where a vector kernel that found an error in the block at p
+// restarts one sequence at a time: the lead byte of a sequence that
+// runs into the block, if any, as the blocks before it are valid.
+const char* Utf8Restart(const char* start, const char* p)
 {
-    auto m = Mark();
-    if (Match(quote)) {
-        while (Not(quote, '\\') || (Match('\\') && Any())) { }
+    for (auto q = p; q != start && p - q < 3;) {
+        auto c = (unsigned char)*--q;
+        if (c >= 0xC0) {
+            return q;
+        }
+        if (c < 0x80) {
+            break;
+        }
     }
-    return Undo(m, Match(quote));
+    return p;
 }
 
-bool Parser::Line()
-{
-    return Until('\n') + Match('\n');
-}
+const Backend Scalar = { "scalar", ScalarFind, ScalarFind2, ScalarFindIn, ScalarFindNotIn, ScalarFindSet, ScalarFindNotSet, ScalarMasks, ScalarFindInvalidUtf8 };
 
-bool Parser::Space()
+#ifdef WALKER_X86
+
+__attribute__((target("sse2"))) const char* Sse2Find(const char* p, const char* e, char a)
 {
-    return While({ '\0' + 1, ' ' });
+    auto va = _mm_set1_epi8(a);
+    for (; e - p >= 16; p += 16) {
+        auto x = _mm_loadu_si128((const __m128i*)p);
+        if (int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, va))) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#ifdef WALKER_PADDED
+    if (p != e) {
+        auto x = _mm_loadu_si128((const __m128i*)p);
+        if (int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, va)) & Below(p, e)) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return e;
+#else
+    return ScalarFind(p, e, a);
+#endif
 }
 
-bool Parser::Until(std::string_view v)
+__attribute__((target("sse2"))) const char* Sse2Find2(const char* p, const char* e, char a, char b)
 {
-    auto m = Mark();
-    while (Not(v)) { }
-    return Moved(m);
+    auto va = _mm_set1_epi8(a);
+    auto vb = _mm_set1_epi8(b);
+    for (; e - p >= 16; p += 16) {
+        auto x = _mm_loadu_si128((const __m128i*)p);
+        if (int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)))) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#ifdef WALKER_PADDED
+    if (p != e) {
+        auto x = _mm_loadu_si128((const __m128i*)p);
+        if (int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb))) & Below(p, e)) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return e;
+#else
+    return ScalarFind2(p, e, a, b);
+#endif
 }
 
-bool Parser::Until(std::pair<char, char> range)
+// Returns a mask of the 16 characters at p that are out of [lo, hi].
+__attribute__((target("sse2"))) int Sse2Outside(const char* p, __m128i lo, __m128i hi)
 {
-    auto m = Mark();
-    while (Not(range)) { }
-    return Moved(m);
+    auto x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi8(bias));
+    return _mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi8(lo, x), _mm_cmpgt_epi8(x, hi)));
 }
 
-bool Parser::Until(char a, char b)
+__attribute__((target("sse2"))) const char* Sse2FindIn(const char* p, const char* e, char lo, char hi)
 {
-    auto m = Mark();
-    while (Not(a, b)) { }
-    return Moved(m);
+    auto vlo = _mm_set1_epi8(lo ^ bias);
+    auto vhi = _mm_set1_epi8(hi ^ bias);
+    for (; e - p >= 16; p += 16) {
+        if (int mask = ~Sse2Outside(p, vlo, vhi) & 0xFFFF) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#ifdef WALKER_PADDED
+    if (p != e) {
+        if (int mask = ~Sse2Outside(p, vlo, vhi) & 0xFFFF & Below(p, e)) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return e;
+#else
+    return ScalarFindIn(p, e, lo, hi);
+#endif
 }
 
-bool Parser::Until(char a)
+__attribute__((target("sse2"))) const char* Sse2FindNotIn(const char* p, const char* e, char lo, char hi)
 {
-    auto m = Mark();
-    while (Not(a)) { }
-    return Moved(m);
+    auto vlo = _mm_set1_epi8(lo ^ bias);
+    auto vhi = _mm_set1_epi8(hi ^ bias);
+    for (; e - p >= 16; p += 16) {
+        if (int mask = Sse2Outside(p, vlo, vhi)) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#ifdef WALKER_PADDED
+    if (p != e) {
+        if (int mask = Sse2Outside(p, vlo, vhi) & Below(p, e)) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return e;
+#else
+    return ScalarFindNotIn(p, e, lo, hi);
+#endif
 }
 
-bool Parser::While(char a)
+__attribute__((target("sse2"))) void Sse2Masks(const char* p, const char* chars, size_t n, uint64_t* out)
 {
-    auto m = Mark();
-    while (Match(a)) { }
-    return Moved(m);
+    __m128i x[4];
+    for (int k = 0; k < 4; k++) {
+        x[k] = _mm_loadu_si128((const __m128i*)(p + k * 16));
+    }
+    for (size_t i = 0; i < n; i++) {
+        auto c = _mm_set1_epi8(chars[i]);
+        out[i] = 0;
+        for (int k = 0; k < 4; k++) {
+            out[i] |= uint64_t(_mm_movemask_epi8(_mm_cmpeq_epi8(x[k], c))) << (k * 16);
+        }
+    }
 }
 
-bool Parser::While(std::pair<char, char> a)
+// Skips ASCII 16 characters at a time, and checks other sequences one
+// at a time.
+__attribute__((target("sse2"))) const char* Sse2FindInvalidUtf8(const char* p, const char* e)
 {
-    auto m = Mark();
-    while (Match(a)) { }
-    return Moved(m);
+    while (e - p >= 16) {
+        if (int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p))) {
+            p += __builtin_ctz(mask);
+            uint32_t code;
+            while (p != e && (unsigned char)*p >= 0x80) {
+                auto q = Decode(p, e, code);
+                if (q == p) {
+                    return p;
+                }
+                p = q;
+            }
+        } else {
+            p += 16;
+        }
+    }
+    return ScalarFindInvalidUtf8(p, e);
 }
 
-bool Parser::While(std::pair<char, char> a, std::pair<char, char> b)
+// SSE2 has no byte shuffle for the nibble lookups.
+const Backend Sse2 = { "sse2", Sse2Find, Sse2Find2, Sse2FindIn, Sse2FindNotIn, ScalarFindSet, ScalarFindNotSet, Sse2Masks, Sse2FindInvalidUtf8 };
+
+__attribute__((target("avx2"))) const char* Avx2Find(const char* p, const char* e, char a)
 {
-    auto m = Mark();
-    while ((Match(a) || Match(b))) { }
-    return Moved(m);
+    auto va = _mm256_set1_epi8(a);
+    for (; e - p >= 32; p += 32) {
+        auto x = _mm256_loadu_si256((const __m256i*)p);
+        if (unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, va))) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#ifdef WALKER_PADDED
+    if (p != e) {
+        auto x = _mm256_loadu_si256((const __m256i*)p);
+        if (unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, va)) & Below(p, e)) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return e;
+#else
+    // The SSE2 code is not VEX encoded, so the upper halves of the
+    // registers must be cleared first to avoid a transition penalty.
+    _mm256_zeroupper();
+    return Sse2Find(p, e, a);
+#endif
 }
 
-bool Parser::While(std::pair<char, char> a, std::pair<char, char> b, std::pair<char, char> c)
+__attribute__((target("avx2"))) const char* Avx2Find2(const char* p, const char* e, char a, char b)
 {
-    auto m = Mark();
-    while ((Match(a) || Match(b) || Match(c))) { }
-    return Moved(m);
+    auto va = _mm256_set1_epi8(a);
+    auto vb = _mm256_set1_epi8(b);
+    for (; e - p >= 32; p += 32) {
+        auto x = _mm256_loadu_si256((const __m256i*)p);
+        if (unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb)))) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#ifdef WALKER_PADDED
+    if (p != e) {
+        auto x = _mm256_loadu_si256((const __m256i*)p);
+        if (unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb))) & Below(p, e)) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return e;
+#else
+    _mm256_zeroupper();
+    return Sse2Find2(p, e, a, b);
+#endif
 }
 
-bool Parser::While(std::pair<char, char> a, std::pair<char, char> b, std::pair<char, char> c, std::pair<char, char> d)
+// Returns a mask of the 32 characters at p that are out of [lo, hi].
+__attribute__((target("avx2"))) unsigned Avx2Outside(const char* p, __m256i lo, __m256i hi)
 {
-    auto m = Mark();
-    while ((Match(a) || Match(b) || Match(c) || Match(d))) { }
-    return Moved(m);
+    auto x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)p), _mm256_set1_epi8(bias));
+    return _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi8(lo, x), _mm256_cmpgt_epi8(x, hi)));
 }
 
-bool Parser::Not(std::string_view v)
+__attribute__((target("avx2"))) const char* Avx2FindIn(const char* p, const char* e, char lo, char hi)
 {
-    return !Equal(v) && Any();
+    auto vlo = _mm256_set1_epi8(lo ^ bias);
+    auto vhi = _mm256_set1_epi8(hi ^ bias);
+    for (; e - p >= 32; p += 32) {
+        if (unsigned mask = ~Avx2Outside(p, vlo, vhi)) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#ifdef WALKER_PADDED
+    if (p != e) {
+        if (unsigned mask = ~Avx2Outside(p, vlo, vhi) & Below(p, e)) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return e;
+#else
+    _mm256_zeroupper();
+    return Sse2FindIn(p, e, lo, hi);
+#endif
 }
 
-bool Parser::Not(std::pair<char, char> range)
+__attribute__((target("avx2"))) const char* Avx2FindNotIn(const char* p, const char* e, char lo, char hi)
 {
-    return !Equal(range) && Any();
+    auto vlo = _mm256_set1_epi8(lo ^ bias);
+    auto vhi = _mm256_set1_epi8(hi ^ bias);
+    for (; e - p >= 32; p += 32) {
+        if (unsigned mask = Avx2Outside(p, vlo, vhi)) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#ifdef WALKER_PADDED
+    if (p != e) {
+        if (unsigned mask = Avx2Outside(p, vlo, vhi) & Below(p, e)) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return e;
+#else
+    _mm256_zeroupper();
+    return Sse2FindNotIn(p, e, lo, hi);
+#endif
 }
 
-bool Parser::Not(char a, char b)
+// Returns a mask of the 32 characters at p that are in the set.
+__attribute__((target("avx2"))) unsigned Avx2Inside(const char* p, __m256i lows, __m256i highs)
 {
-    return !Equal(a, b) && Any();
+    auto x = _mm256_loadu_si256((const __m256i*)p);
+    auto nibble = _mm256_set1_epi8(0x0F);
+    auto lo = _mm256_shuffle_epi8(lows, _mm256_and_si256(x, nibble));
+    auto hi = _mm256_shuffle_epi8(highs, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+    return ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256()));
 }
 
-bool Parser::Not(char a)
+__attribute__((target("avx2"))) const char* Avx2FindSet(const char* p, const char* e, const Table& set)
 {
-    return !Equal(a) && Any();
+    if (set.nibbles) {
+        auto lows = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set.lows));
+        auto highs = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set.highs));
+        for (; e - p >= 32; p += 32) {
+            if (unsigned mask = Avx2Inside(p, lows, highs)) {
+                return p + __builtin_ctz(mask);
+            }
+        }
+#ifdef WALKER_PADDED
+        if (p != e) {
+            if (unsigned mask = Avx2Inside(p, lows, highs) & Below(p, e)) {
+                return p + __builtin_ctz(mask);
+            }
+        }
+        return e;
+#else
+        _mm256_zeroupper();
+#endif
+    }
+    return ScalarFindSet(p, e, set);
 }
 
-bool Parser::Match(std::string_view v)
+__attribute__((target("avx2"))) const char* Avx2FindNotSet(const char* p, const char* e, const Table& set)
 {
-    if (Equal(v)) {
-        Advance(v.size());
-        return true;
+    if (set.nibbles) {
+        auto lows = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set.lows));
+        auto highs = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set.highs));
+        for (; e - p >= 32; p += 32) {
+            if (unsigned mask = ~Avx2Inside(p, lows, highs)) {
+                return p + __builtin_ctz(mask);
+            }
+        }
+#ifdef WALKER_PADDED
+        if (p != e) {
+            if (unsigned mask = ~Avx2Inside(p, lows, highs) & Below(p, e)) {
+                return p + __builtin_ctz(mask);
+            }
+        }
+        return e;
+#else
+        _mm256_zeroupper();
+#endif
     }
-    return false;
+    return ScalarFindNotSet(p, e, set);
 }
 
-bool Parser::Match(std::pair<char, char> range)
+__attribute__((target("avx2"))) void Avx2Masks(const char* p, const char* chars, size_t n, uint64_t* out)
 {
-    return Equal(range) && Any();
+    auto lo = _mm256_loadu_si256((const __m256i*)p);
+    auto hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+    for (size_t i = 0; i < n; i++) {
+        auto c = _mm256_set1_epi8(chars[i]);
+        uint32_t a = _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, c));
+        uint32_t b = _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, c));
+        out[i] = uint64_t(b) << 32 | a;
+    }
 }
 
-bool Parser::Match(char a, char b)
+// Classes of errors of two consecutive bytes, looked up by the high and
+// low nibbles of the first byte and the high nibble of the second one,
+// as in "Validating UTF-8 in less than one instruction per byte" by
+// Keiser and Lemire. A pair is invalid if the three lookups share a bit.
+namespace utf8 {
+constexpr uint8_t tooShort = 1 << 0; // 11______ 0_______ or 11______ 11______
+constexpr uint8_t tooLong = 1 << 1; // 0_______ 10______
+constexpr uint8_t overlong3 = 1 << 2; // 11100000 100_____
+constexpr uint8_t tooLarge = 1 << 3; // 11110100 1001____ or 11110101 ________ and above
+constexpr uint8_t surrogate = 1 << 4; // 11101101 101_____
+constexpr uint8_t overlong2 = 1 << 5; // 1100000_ 10______
+constexpr uint8_t tooLarge1000 = 1 << 6; // 11110101 1000____ and above
+constexpr uint8_t overlong4 = 1 << 6; // 11110000 1000____
+constexpr uint8_t twoConts = 1 << 7; // 10______ 10______
+constexpr uint8_t carry = tooShort | tooLong | twoConts;
+
+alignas(16) constexpr uint8_t byte1High[16] = {
+    tooLong, tooLong, tooLong, tooLong, tooLong, tooLong, tooLong, tooLong,
+    twoConts, twoConts, twoConts, twoConts,
+    tooShort | overlong2,
+    tooShort,
+    tooShort | overlong3 | surrogate,
+    tooShort | tooLarge | tooLarge1000 | overlong4
+};
+alignas(16) constexpr uint8_t byte1Low[16] = {
+    carry | overlong3 | overlong2 | overlong4,
+    carry | overlong2,
+    carry,
+    carry,
+    carry | tooLarge,
+    carry | tooLarge | tooLarge1000,
+    carry | tooLarge | tooLarge1000,
+    carry | tooLarge | tooLarge1000,
+    carry | tooLarge | tooLarge1000,
+    carry | tooLarge | tooLarge1000,
+    carry | tooLarge | tooLarge1000,
+    carry | tooLarge | tooLarge1000,
+    carry | tooLarge | tooLarge1000,
+    carry | tooLarge | tooLarge1000 | surrogate,
+    carry | tooLarge | tooLarge1000,
+    carry | tooLarge | tooLarge1000
+};
+alignas(16) constexpr uint8_t byte2High[16] = {
+    tooShort, tooShort, tooShort, tooShort, tooShort, tooShort, tooShort, tooShort,
+    tooLong | overlong2 | twoConts | overlong3 | tooLarge1000 | overlong4,
+    tooLong | overlong2 | twoConts | overlong3 | tooLarge,
+    tooLong | overlong2 | twoConts | surrogate | tooLarge,
+    tooLong | overlong2 | twoConts | surrogate | tooLarge,
+    tooShort, tooShort, tooShort, tooShort
+};
+// Bytes at the end of a block that need more bytes after them.
+alignas(32) constexpr uint8_t incomplete[32] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+};
+}
+
+// Returns the block shifted by n bytes, with the last bytes of the
+// previous block first.
+template <int n>
+__attribute__((target("avx2"))) __m256i Avx2Prev(__m256i block, __m256i prev)
+{
+    return _mm256_alignr_epi8(block, _mm256_permute2x128_si256(prev, block, 0x21), 16 - n);
+}
+
+__attribute__((target("avx2"))) __m256i Avx2Lookup(const uint8_t* table, __m256i nibbles)
+{
+    return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)table)), nibbles);
+}
+
+// Checks 32 bytes at a time with the lookups of Keiser and Lemire,
+// and skips blocks of ASCII with a single test.
+__attribute__((target("avx2"))) const char* Avx2FindInvalidUtf8(const char* p, const char* e)
+{
+    auto start = p;
+    auto nibble = _mm256_set1_epi8(0x0F);
+    auto third = _mm256_set1_epi8(char(0xE0 - 0x80));
+    auto fourth = _mm256_set1_epi8(char(0xF0 - 0x80));
+    auto incomplete = _mm256_load_si256((const __m256i*)utf8::incomplete);
+    auto prev = _mm256_setzero_si256();
+    auto pending = _mm256_setzero_si256();
+    for (; e - p >= 32; p += 32) {
+        auto block = _mm256_loadu_si256((const __m256i*)p);
+        __m256i error;
+        if (_mm256_movemask_epi8(block) == 0) {
+            // Only the sequence that the previous block started can fail.
+            error = pending;
+        } else {
+            auto prev1 = Avx2Prev<1>(block, prev);
+            auto high1 = _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble);
+            auto low1 = _mm256_and_si256(prev1, nibble);
+            auto high2 = _mm256_and_si256(_mm256_srli_epi16(block, 4), nibble);
+            auto special = _mm256_and_si256(
+                _mm256_and_si256(Avx2Lookup(utf8::byte1High, high1), Avx2Lookup(utf8::byte1Low, low1)),
+                Avx2Lookup(utf8::byte2High, high2));
+            // The third and fourth bytes of sequences must be continuations,
+            // which the lookups counted as two continuations in a row.
+            auto must = _mm256_or_si256(
+                _mm256_subs_epu8(Avx2Prev<2>(block, prev), third),
+                _mm256_subs_epu8(Avx2Prev<3>(block, prev), fourth));
+            error = _mm256_xor_si256(_mm256_and_si256(must, _mm256_set1_epi8(char(0x80))), special);
+            pending = _mm256_subs_epu8(block, incomplete);
+        }
+        if (!_mm256_testz_si256(error, error)) {
+            break;
+        }
+        prev = block;
+    }
+    _mm256_zeroupper();
+    // Finds the exact error, or checks the rest, one sequence at a time.
+    return ScalarFindInvalidUtf8(Utf8Restart(start, p), e);
+}
+
+const Backend Avx2 = { "avx2", Avx2Find, Avx2Find2, Avx2FindIn, Avx2FindNotIn, Avx2FindSet, Avx2FindNotSet, Avx2Masks, Avx2FindInvalidUtf8 };
+
+#endif
+
+const Backend& Best()
+{
+#ifdef WALKER_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return Avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return Sse2;
+    }
+#endif
+    return Scalar;
+}
+
+const Backend* active = &Best();
+
+const Backend& Active()
+{
+    return *active;
+}
+
+void Use(const Backend& b)
+{
+    active = &b;
+}
+
+const char* Find(const char* p, const char* e, char a)
+{
+    return active->find(p, e, a);
+}
+
+const char* Find(const char* p, const char* e, char a, char b)
+{
+    return active->find2(p, e, a, b);
+}
+
+const char* FindIn(const char* p, const char* e, char lo, char hi)
+{
+    return active->findIn(p, e, lo, hi);
+}
+
+const char* FindNotIn(const char* p, const char* e, char lo, char hi)
+{
+    return active->findNotIn(p, e, lo, hi);
+}
+
+void Masks(const char* p, const char* chars, size_t n, uint64_t* out)
+{
+    active->masks(p, chars, n, out);
+}
+
+const char* FindIn(const char* p, const char* e, const Table& set)
+{
+    return active->findSet(p, e, set);
+}
+
+const char* FindNotIn(const char* p, const char* e, const Table& set)
+{
+    return active->findNotSet(p, e, set);
+}
+
+const char* FindInvalidUtf8(const char* p, const char* e)
+{
+    return active->findInvalidUtf8(p, e);
+}
+
+}
+
+constexpr CharSet::CharSet(std::string_view spec)
+{
+    for (size_t i = 0; i < spec.size(); i++) {
+        if (i + 2 < spec.size() && spec[i + 1] == '-') {
+            Add(spec[i], spec[i + 2]);
+            i += 2;
+        } else {
+            Add(spec[i], spec[i]);
+        }
+    }
+    Index();
+}
+
+constexpr CharSet::CharSet(std::initializer_list<std::pair<char, char>> ranges)
+{
+    for (auto&& r : ranges) {
+        Add(r.first, r.second);
+    }
+    Index();
+}
+
+constexpr bool CharSet::Has(char c) const
+{
+    return table.has[(unsigned char)c];
+}
+
+constexpr CharSet CharSet::operator|(const CharSet& o) const
+{
+    CharSet r;
+    for (int i = 0; i < 256; i++) {
+        r.table.has[i] = table.has[i] || o.table.has[i];
+    }
+    r.Index();
+    return r;
+}
+
+constexpr CharSet CharSet::operator~() const
+{
+    CharSet r;
+    for (int i = 0; i < 256; i++) {
+        r.table.has[i] = !table.has[i];
+    }
+    r.Index();
+    return r;
+}
+
+constexpr void CharSet::Add(char lo, char hi)
+{
+    for (int c = lo; c <= hi; c++) {
+        table.has[(unsigned char)c] = true;
+    }
+}
+
+constexpr const scan::Table& CharSet::Table() const
+{
+    return table;
+}
+
+constexpr void CharSet::Index()
+{
+    // Each high nibble has a row with the low nibbles in the set.
+    // Equal rows share a bit, so up to 8 different rows fit in a byte.
+    uint16_t rows[16] = {};
+    for (int c = 0; c < 256; c++) {
+        if (table.has[c]) {
+            rows[c >> 4] |= 1 << (c & 15);
+        }
+    }
+    uint16_t bits[8] = {};
+    int count = 0;
+    for (int h = 0; h < 16; h++) {
+        if (rows[h] == 0) {
+            table.highs[h] = 0;
+            continue;
+        }
+        int b = 0;
+        while (b < count && bits[b] != rows[h]) {
+            b++;
+        }
+        if (b == 8) {
+            table.nibbles = false;
+            return;
+        }
+        if (b == count) {
+            bits[count++] = rows[h];
+        }
+        table.highs[h] = 1 << b;
+    }
+    for (int l = 0; l < 16; l++) {
+        table.lows[l] = 0;
+        for (int b = 0; b < count; b++) {
+            if (bits[b] >> l & 1) {
+                table.lows[l] |= 1 << b;
+            }
+        }
+    }
+    table.nibbles = true;
+}
+
+UnicodeClass::UnicodeClass(std::initializer_list<std::pair<uint32_t, uint32_t>> ranges)
+{
+    for (auto [lo, hi] : ranges) {
+        Add(lo, hi);
+    }
+}
+
+bool UnicodeClass::Has(uint32_t code) const
+{
+    if (code < 0x80) {
+        return ascii.Has(char(code));
+    }
+    // The last range starting at or before the code point.
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), code, [](uint32_t c, const auto& r) { return c < r.first; });
+    return it != ranges.begin() && code <= std::prev(it)->second;
+}
+
+UnicodeClass UnicodeClass::operator|(const UnicodeClass& o) const
+{
+    UnicodeClass u = *this;
+    u.ascii = u.ascii | o.ascii;
+    for (auto [lo, hi] : o.ranges) {
+        u.Add(lo, hi);
+    }
+    return u;
+}
+
+const CharSet& UnicodeClass::Ascii() const
+{
+    return ascii;
+}
+
+void UnicodeClass::Add(uint32_t lo, uint32_t hi)
+{
+    if (lo > hi) {
+        return;
+    }
+    if (lo < 0x80) {
+        ascii = ascii | CharSet({ { char(lo), char(std::min<uint32_t>(hi, 0x7F)) } });
+        if (hi < 0x80) {
+            return;
+        }
+        lo = 0x80;
+    }
+    // Merges the ranges that overlap or touch the new one.
+    auto first = std::lower_bound(ranges.begin(), ranges.end(), lo, [](const auto& r, uint32_t c) { return r.second + 1 < c; });
+    auto last = first;
+    while (last != ranges.end() && last->first <= hi + 1) {
+        lo = std::min(lo, last->first);
+        hi = std::max(hi, last->second);
+        last++;
+    }
+    first = ranges.erase(first, last);
+    ranges.insert(first, { lo, hi });
+}
+
+size_t Tokens::Size() const
+{
+    return kinds.size();
+}
+
+void Tokens::Clear()
+{
+    offsets.clear();
+    lengths.clear();
+    kinds.clear();
+}
+
+void Tokens::Reserve(size_t n)
+{
+    offsets.reserve(n);
+    lengths.reserve(n);
+    kinds.reserve(n);
+}
+
+uint32_t Tokens::Offset(size_t i) const
+{
+    return offsets[i];
+}
+
+uint32_t Tokens::Length(size_t i) const
+{
+    return lengths[i];
+}
+
+uint8_t Tokens::Kind(size_t i) const
+{
+    return kinds[i];
+}
+
+std::string_view Tokens::View(size_t i) const
+{
+    return text.substr(offsets[i], lengths[i]);
+}
+
+void Tokens::Push(uint32_t offset, uint32_t length, uint8_t kind)
+{
+    offsets.push_back(offset);
+    lengths.push_back(length);
+    kinds.push_back(kind);
+}
+
+size_t Tree::Size() const
+{
+    return kinds.size();
+}
+
+void Tree::Clear()
+{
+    Truncate(0);
+    open.clear();
+}
+
+void Tree::Reserve(size_t n)
+{
+    kinds.reserve(n);
+    starts.reserve(n);
+    ends.reserve(n);
+    firsts.reserve(n);
+}
+
+uint16_t Tree::Kind(size_t i) const
+{
+    return kinds[i];
+}
+
+Pos Tree::Start(size_t i) const
+{
+    return { starts[i] };
+}
+
+Pos Tree::End(size_t i) const
+{
+    return { ends[i] };
+}
+
+std::string_view Tree::View(size_t i) const
+{
+    return text.substr(starts[i], ends[i] - starts[i]);
+}
+
+size_t Tree::First(size_t i) const
+{
+    return firsts[i];
+}
+
+void Tree::Children(size_t i, std::vector<size_t>& out) const
+{
+    out.clear();
+    for (auto c = i; c > firsts[i]; c = firsts[c - 1]) {
+        out.push_back(c - 1);
+    }
+    std::reverse(out.begin(), out.end());
+}
+
+void Tree::Truncate(size_t n)
+{
+    if (n < kinds.size()) {
+        kinds.resize(n);
+        starts.resize(n);
+        ends.resize(n);
+        firsts.resize(n);
+    }
+}
+
+void Tree::Rewind(uint32_t offset)
+{
+    auto n = kinds.size();
+    while (n > 0 && ends[n - 1] > offset) {
+        n--;
+    }
+    if (n < kinds.size()) {
+        Truncate(n);
+        // The nodes still open adopt no dropped nodes.
+        for (auto& p : open) {
+            p.first = std::min(p.first, uint32_t(n));
+        }
+    }
+}
+
+PaddedString::PaddedString(std::string_view text)
+{
+    data.reserve(text.size() + padding);
+    data.append(text);
+    data.append(padding, '\0');
+}
+
+std::string_view PaddedString::View() const
+{
+    return std::string_view(data).substr(0, data.size() - padding);
+}
+
+PaddedString::operator std::string_view() const
+{
+    return View();
+}
+
+Patterns::Patterns(std::initializer_list<std::string_view> patterns)
+    : Patterns(std::vector<std::string_view>(patterns))
+{
+}
+
+Patterns::Patterns(const std::vector<std::string_view>& list)
+{
+    // Numbers the bytes used by the patterns. Class 0 stands for
+    // every other byte, which always leads back to the root.
+    for (auto v : list) {
+        patterns.emplace_back(v);
+        maxLength = std::max(maxLength, v.size());
+        for (auto c : v) {
+            auto& k = classes[(unsigned char)c];
+            if (k == 0) {
+                k = classCount++;
+            }
+        }
+    }
+
+    // Builds the trie, where 0 means no child as the root is no one's child.
+    auto none = uint32_t(Size());
+    next.assign(classCount, 0);
+    depth.assign(1, 0);
+    term.assign(1, none);
+    for (size_t i = 0; i < Size(); i++) {
+        auto& v = patterns[i];
+        if (v.empty()) {
+            continue;
+        }
+        uint32_t s = 0;
+        for (auto c : v) {
+            auto& n = next[s * classCount + classes[(unsigned char)c]];
+            if (n == 0) {
+                n = depth.size();
+                next.resize(next.size() + classCount, 0);
+                depth.push_back(depth[s] + 1);
+                term.push_back(none);
+            }
+            s = next[s * classCount + classes[(unsigned char)c]];
+        }
+        if (term[s] == none) {
+            term[s] = i;
+        }
+        auto& f = first[(unsigned char)v[0]];
+        if (!f && firstCount++ < 2) {
+            firstBytes[firstCount - 1] = v[0];
+        }
+        f = true;
+    }
+
+    // Turns the trie into a DFA breadth first, so the failure state
+    // of each state, being shallower, is complete before it is used.
+    std::vector<uint32_t> fail(depth.size(), 0);
+    out = term;
+    std::vector<uint32_t> queue = { 0 };
+    for (size_t q = 0; q < queue.size(); q++) {
+        auto s = queue[q];
+        for (size_t c = 0; c < classCount; c++) {
+            auto& n = next[s * classCount + c];
+            auto f = s == 0 ? 0 : next[fail[s] * classCount + c];
+            if (n == 0) {
+                n = f;
+                continue;
+            }
+            fail[n] = f;
+            if (out[n] == none) {
+                out[n] = out[f];
+            }
+            queue.push_back(n);
+        }
+    }
+}
+
+size_t Patterns::Size() const
+{
+    return patterns.size();
+}
+
+std::string_view Patterns::Pattern(size_t i) const
+{
+    return patterns[i];
+}
+
+bool Patterns::Starts(char c) const
+{
+    return first[(unsigned char)c];
+}
+
+const char* Patterns::Find(const char* p, const char* e) const
+{
+    auto best = e;
+    uint32_t s = 0;
+    while (p != e) {
+        if (s == 0) {
+            if (firstCount == 1) {
+                p = scan::Find(p, e, firstBytes[0]);
+            } else if (firstCount == 2) {
+                p = scan::Find(p, e, firstBytes[0], firstBytes[1]);
+            } else {
+                while (p != e && !first[(unsigned char)*p]) {
+                    p++;
+                }
+            }
+            if (p == e) {
+                break;
+            }
+        }
+        s = next[s * classCount + classes[(unsigned char)*p++]];
+        if (out[s] != Size()) {
+            // Keeps going while a pattern could still start further left.
+            best = std::min(best, p - patterns[out[s]].size());
+        }
+        if (best != e && size_t(p - best) >= maxLength) {
+            break;
+        }
+    }
+    return best;
+}
+
+size_t Patterns::Longest(const char* p, const char* e) const
+{
+    // Follows the trie, whose edges are the only ones going deeper.
+    auto longest = Size();
+    uint32_t s = 0;
+    for (; p != e; p++) {
+        auto n = next[s * classCount + classes[(unsigned char)*p]];
+        if (depth[n] != depth[s] + 1) {
+            break;
+        }
+        s = n;
+        if (term[s] != Size()) {
+            longest = term[s];
+        }
+    }
+    return longest;
+}
+
+bool Parser::Out(std::string_view m, bool cond, std::string_view& out)
+{
+    if (cond) {
+        out = Token(m);
+    }
+    return cond;
+}
+
+bool Parser::Out(std::string_view m, bool cond, std::string& out)
+{
+    if (cond) {
+        out = Token(m);
+    }
+    return cond;
+}
+
+bool Parser::Out(std::string_view m, bool cond, std::vector<std::string_view>& out)
+{
+    if (cond) {
+        out.push_back(Token(m));
+    }
+    return cond;
+}
+
+bool Parser::Out(std::string_view m, bool cond, std::vector<std::string>& out)
+{
+    if (cond) {
+        out.push_back(std::string(Token(m)));
+    }
+    return cond;
+}
+
+bool Parser::Out(std::string_view m, bool cond, Tokens& out, uint8_t kind)
+{
+    if (cond) {
+        assert(base.size() <= UINT32_MAX && "Text too large for 32-bit offsets");
+        out.text = base;
+        out.Push(Offset(m), m.size() - text.size(), kind);
+    }
+    return cond;
+}
+
+void Parser::Build(Tree& t)
+{
+    tree = &t;
+    tree->text = base;
+}
+
+bool Parser::Open(uint16_t kind)
+{
+    if (!tree) {
+        return true;
+    }
+    assert(base.size() <= UINT32_MAX && "Text too large for 32-bit offsets");
+    tree->open.push_back({ kind, uint32_t(Offset(text)), uint32_t(tree->Size()) });
+    return true;
+}
+
+bool Parser::Close(bool cond)
+{
+    if (!tree) {
+        return cond;
+    }
+    assert(!tree->open.empty() && "Close without Open");
+    auto n = tree->open.back();
+    tree->open.pop_back();
+    if (cond) {
+        tree->kinds.push_back(n.kind);
+        tree->starts.push_back(n.start);
+        tree->ends.push_back(Offset(text));
+        tree->firsts.push_back(n.first);
+    } else {
+        tree->Truncate(n.first);
+    }
+    return cond;
+}
+
+bool Parser::Peek(std::string_view m, bool cond)
+{
+    Back(m);
+    return cond;
+}
+
+bool Parser::Undo(std::string_view m, bool cond)
+{
+    if (!cond) {
+        Back(m);
+    }
+    return cond;
+}
+
+template <typename F>
+bool Parser::Profile(std::string_view name, F f)
+{
+#ifdef WALKER_PROFILE
+    // Looks the name up once per thread. Keyed by the copy of
+    // the registry, as the name may not outlive the call.
+    thread_local std::unordered_map<std::string_view, uint32_t> ids;
+    auto it = ids.find(name);
+    if (it == ids.end()) {
+        auto id = profile::Id(name, true);
+        it = ids.emplace(profile::Name(id), id).first;
+    }
+    profile::Scope scope(it->second, false, text);
+    return scope.Done(f());
+#else
+    (void)name;
+    return f();
+#endif
+}
+
+bool Parser::Number(float& out)
+{
+    WALKER_PRIMITIVE("Number");
+    return ParseFloat(out) || Miss(Expect::Name, 0, 0, "number");
+}
+
+bool Parser::Number(double& out)
+{
+    WALKER_PRIMITIVE("Number");
+    return ParseFloat(out) || Miss(Expect::Name, 0, 0, "number");
+}
+
+bool Parser::Number(int& out)
+{
+    WALKER_PRIMITIVE("Number");
+    return ParseInt(out) || Miss(Expect::Name, 0, 0, "number");
+}
+
+bool Parser::Number(int64_t& out)
+{
+    WALKER_PRIMITIVE("Number");
+    return ParseInt(out) || Miss(Expect::Name, 0, 0, "number");
+}
+
+bool Parser::Number(uint64_t& out)
+{
+    WALKER_PRIMITIVE("Number");
+    return ParseInt(out) || Miss(Expect::Name, 0, 0, "number");
+}
+
+template <typename T>
+bool Parser::ParseInt(T& out)
+{
+    auto p = text.data();
+    auto e = End();
+    auto d = p;
+    if (d != e && (*d == '-' || *d == '+')) {
+        d++;
+    }
+    uint64_t v = 0;
+    auto q = Digits(d, e, v);
+    if (q == d) {
+        return false;
+    }
+    bool neg = *p == '-';
+    if (neg && std::is_unsigned_v<T>) {
+        return false;
+    }
+    if (q - d <= 19) {
+        uint64_t max = std::numeric_limits<T>::max();
+        if (v > max + neg) {
+            return false;
+        }
+        out = neg ? T(0 - v) : T(v);
+        Seek(q);
+        return true;
+    }
+    // Longer runs have leading zeros or overflow.
+    // std::from_chars takes the minus sign but not the plus sign.
+    T n;
+    auto r = std::from_chars(*p == '+' ? d : p, e, n);
+    if (r.ec != std::errc()) {
+        return false;
+    }
+    out = n;
+    Seek(r.ptr);
+    return true;
+}
+
+template <typename T>
+bool Parser::ParseFloat(T& out)
+{
+    // Powers of ten that T represents exactly.
+    static constexpr T powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    constexpr int64_t maxPower = std::is_same_v<T, float> ? 10 : 22;
+    constexpr uint64_t maxMantissa = uint64_t(1) << std::numeric_limits<T>::digits;
+
+    auto p = text.data();
+    auto e = End();
+    auto d = p;
+    if (d != e && (*d == '-' || *d == '+')) {
+        d++;
+    }
+    // The digits before and after the point make up the mantissa.
+    uint64_t m = 0;
+    auto i = Digits(d, e, m);
+    auto f = i;
+    auto fe = i;
+    if (i != e && *i == '.') {
+        f = i + 1;
+        fe = Digits(f, e, m);
+    }
+    if (i == d && fe == f) {
+        return false;
+    }
+    // An exponent without digits fails the whole number, like Float().
+    auto q = fe;
+    int64_t exp = 0;
+    bool wide = false;
+    if (q != e && (*q == 'e' || *q == 'E')) {
+        auto s = q + 1;
+        if (s != e && (*s == '-' || *s == '+')) {
+            s++;
+        }
+        uint64_t x = 0;
+        q = Digits(s, e, x);
+        if (q == s) {
+            return false;
+        }
+        wide = q - s > 4;
+        exp = s[-1] == '-' ? -int64_t(x) : int64_t(x);
+    }
+    // Numbers with few digits and a small exponent are exact products or
+    // quotients of two doubles, which round correctly (Clinger's fast path).
+    // std::from_chars converts the others.
+    if (!wide && (i - d) + (fe - f) <= 19) {
+        exp -= fe - f;
+        if (m <= maxMantissa && exp >= -maxPower && exp <= maxPower) {
+            T v = T(m);
+            v = exp < 0 ? v / powers[-exp] : v * powers[exp];
+            out = *p == '-' ? -v : v;
+            Seek(q);
+            return true;
+        }
+    }
+    T v;
+    auto r = std::from_chars(d, e, v);
+    if (r.ec != std::errc() || r.ptr != q) {
+        return false;
+    }
+    out = *p == '-' ? -v : v;
+    Seek(r.ptr);
+    return true;
+}
+
+inline const char* Parser::Digits(const char* p, const char* e, uint64_t& v)
+{
+    static_assert(std::endian::native == std::endian::little, "Digits reads the first digit in the low byte");
+    for (; e - p >= 8; p += 8) {
+        uint64_t x;
+        std::memcpy(&x, p, 8);
+        // Each digit is 0x3X with X + 6 below 16.
+        if (((x & 0xF0F0F0F0F0F0F0F0) | (((x + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) != 0x3333333333333333) {
+            break;
+        }
+        // Combines pairs of digits, then pairs of pairs and so on.
+        x -= 0x3030303030303030;
+        x = x * 10 + (x >> 8);
+        x = ((x & 0x000000FF000000FF) * (100 + (1000000ULL << 32)) + ((x >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32))) >> 32;
+        v = v * 100000000 + x;
+    }
+    for (; p != e && *p >= '0' && *p <= '9'; p++) {
+        v = v * 10 + (*p - '0');
+    }
+    return p;
+}
+
+bool Parser::Float()
+{
+    WALKER_PRIMITIVE("Float");
+    auto p = text.data();
+    auto e = End();
+    if (p != e && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    auto q = p;
+    uint64_t v = 0;
+    if (q != e && *q == '.') {
+        q = Digits(q + 1, e, v);
+        if (q == p + 1) {
+            return Miss(Expect::Name, 0, 0, "float");
+        }
+    } else {
+        q = Digits(q, e, v);
+        if (q != p && q != e && *q == '.') {
+            q = Digits(q + 1, e, v);
+        }
+    }
+    if (q != e && (*q == 'e' || *q == 'E')) {
+        auto s = q + 1;
+        if (s != e && (*s == '-' || *s == '+')) {
+            s++;
+        }
+        q = Digits(s, e, v);
+        if (q == s) {
+            return Miss(Expect::Name, 0, 0, "float");
+        }
+    }
+    if (q == p) {
+        return Miss(Expect::Name, 0, 0, "float");
+    }
+    Seek(q);
+    return true;
+}
+
+bool Parser::Integer()
+{
+    WALKER_PRIMITIVE("Integer");
+    auto p = text.data();
+    auto e = End();
+    auto d = p != e && (*p == '-' || *p == '+') ? p + 1 : p;
+    uint64_t v = 0;
+    auto q = Digits(d, e, v);
+    if (q == d) {
+        return Miss(Expect::Name, 0, 0, "integer");
+    }
+    Seek(q);
+    return true;
+}
+
+bool Parser::String(char quote)
+{
+    WALKER_PRIMITIVE("String");
+    auto m = Mark();
+    if (Accept(quote)) {
+        // Jumps from one quote or backslash to the next,
+        // skipping the character after each backslash.
+        auto p = text.data();
+        auto e = End();
+        while ((p = Find(p, e, quote, '\\')) != e && *p == '\\') {
+            p = e - p > 2 ? p + 2 : e;
+        }
+        Seek(p);
+    }
+    return Undo(m, Accept(quote)) || Miss(Expect::Name, 0, 0, "string");
+}
+
+bool Parser::String(char quote, std::string& out)
+{
+    WALKER_PRIMITIVE("String");
+    auto m = Mark();
+    out.clear();
+    if (Accept(quote)) {
+        auto p = text.data();
+        auto e = End();
+        for (auto q = p; (q = Find(p, e, quote, '\\')) != e;) {
+            out.append(p, q);
+            if (*q != '\\') {
+                Seek(q);
+                return Accept(quote);
+            }
+            if (e - q < 2) {
+                break;
+            }
+            p = Unescape(q + 1, out);
+        }
+        out.clear();
+    }
+    Back(m);
+    return Miss(Expect::Name, 0, 0, "string");
+}
+
+inline const char* Parser::Find(const char* p, const char* e, char a, char b)
+{
+    for (auto stop = e - p > 8 ? p + 8 : e; p != stop; p++) {
+        if (*p == a || *p == b) {
+            return p;
+        }
+    }
+    return p == e ? e : scan::Find(p, e, a, b);
+}
+
+const char* Parser::Unescape(const char* p, std::string& out)
+{
+    // Reads the four hex digits of a \uXXXX escape at p.
+    auto e = End();
+    auto hex = [&](const char* q, uint32_t& code) {
+        return e - q >= 4 && std::from_chars(q, q + 4, code, 16).ptr == q + 4;
+    };
+    uint32_t code = 0;
+    uint32_t low = 0;
+    switch (*p) {
+    case 'b':
+        out += '\b';
+        break;
+    case 'f':
+        out += '\f';
+        break;
+    case 'n':
+        out += '\n';
+        break;
+    case 'r':
+        out += '\r';
+        break;
+    case 't':
+        out += '\t';
+        break;
+    case 'u':
+        if (!hex(p + 1, code)) {
+            out += 'u';
+            break;
+        }
+        p += 4;
+        // Joins a surrogate pair into one code point.
+        if (code >= 0xD800 && code < 0xDC00 && e - p >= 7 && p[1] == '\\' && p[2] == 'u'
+            && hex(p + 3, low) && low >= 0xDC00 && low < 0xE000) {
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            p += 6;
+        }
+        Encode(code, out);
+        break;
+    default:
+        out += *p;
+    }
+    return p + 1;
+}
+
+void Parser::Encode(uint32_t code, std::string& out)
+{
+    if (code < 0x80) {
+        out += char(code);
+    } else if (code < 0x800) {
+        out += char(0xC0 | code >> 6);
+        out += char(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += char(0xE0 | code >> 12);
+        out += char(0x80 | (code >> 6 & 0x3F));
+        out += char(0x80 | (code & 0x3F));
+    } else {
+        out += char(0xF0 | code >> 18);
+        out += char(0x80 | (code >> 12 & 0x3F));
+        out += char(0x80 | (code >> 6 & 0x3F));
+        out += char(0x80 | (code & 0x3F));
+    }
+}
+
+bool Parser::Line()
+{
+    WALKER_PRIMITIVE("Line");
+    return Until('\n') + Accept('\n');
+}
+
+bool Parser::Space()
+{
+    WALKER_PRIMITIVE("Space");
+    return While({ '\0' + 1, ' ' });
+}
+
+bool Parser::Until(std::string_view v)
+{
+    WALKER_PRIMITIVE("Until");
+    if (v.empty()) {
+        return false;
+    }
+    auto m = Mark();
+    auto p = text.data();
+    auto e = End();
+    while ((p = scan::Find(p, e, v[0])) != e && std::string_view(p, e - p).substr(0, v.size()) != v) {
+        p++;
+    }
+    Seek(p);
+    return Moved(m);
+}
+
+bool Parser::Until(const Patterns& set)
+{
+    WALKER_PRIMITIVE("Until");
+    auto m = Mark();
+    Seek(set.Find(text.data(), End()));
+    return Moved(m);
+}
+
+bool Parser::Until(std::pair<char, char> range)
+{
+    WALKER_PRIMITIVE("Until");
+    auto m = Mark();
+    Seek(scan::FindIn(text.data(), End(), range.first, range.second));
+    return Moved(m);
+}
+
+bool Parser::Until(const CharSet& set)
+{
+    WALKER_PRIMITIVE("Until");
+    auto m = Mark();
+    Seek(scan::FindIn(text.data(), End(), set.Table()));
+    return Moved(m);
+}
+
+bool Parser::Until(char a, char b)
+{
+    WALKER_PRIMITIVE("Until");
+    auto m = Mark();
+    Seek(scan::Find(text.data(), End(), a, b));
+    return Moved(m);
+}
+
+bool Parser::Until(char a)
+{
+    WALKER_PRIMITIVE("Until");
+    auto m = Mark();
+    Seek(scan::Find(text.data(), End(), a));
+    return Moved(m);
+}
+
+bool Parser::While(char a)
+{
+    WALKER_PRIMITIVE("While");
+    auto m = Mark();
+    while (Accept(a)) { }
+    return Moved(m);
+}
+
+bool Parser::While(std::pair<char, char> a)
+{
+    WALKER_PRIMITIVE("While");
+    auto m = Mark();
+    Seek(scan::FindNotIn(text.data(), End(), a.first, a.second));
+    return Moved(m);
+}
+
+bool Parser::While(std::pair<char, char> a, std::pair<char, char> b)
+{
+    WALKER_PRIMITIVE("While");
+    auto m = Mark();
+    auto p = text.data();
+    auto e = End();
+    while (p != e && (In(*p, a) || In(*p, b))) {
+        p++;
+    }
+    Seek(p);
+    return Moved(m);
+}
+
+bool Parser::While(std::pair<char, char> a, std::pair<char, char> b, std::pair<char, char> c)
+{
+    WALKER_PRIMITIVE("While");
+    auto m = Mark();
+    auto p = text.data();
+    auto e = End();
+    while (p != e && (In(*p, a) || In(*p, b) || In(*p, c))) {
+        p++;
+    }
+    Seek(p);
+    return Moved(m);
+}
+
+bool Parser::While(std::pair<char, char> a, std::pair<char, char> b, std::pair<char, char> c, std::pair<char, char> d)
+{
+    WALKER_PRIMITIVE("While");
+    auto m = Mark();
+    auto p = text.data();
+    auto e = End();
+    while (p != e && (In(*p, a) || In(*p, b) || In(*p, c) || In(*p, d))) {
+        p++;
+    }
+    Seek(p);
+    return Moved(m);
+}
+
+bool Parser::While(const CharSet& set)
+{
+    WALKER_PRIMITIVE("While");
+    auto m = Mark();
+    Seek(scan::FindNotIn(text.data(), End(), set.Table()));
+    return Moved(m);
+}
+
+bool Parser::Not(std::string_view v)
 {
-    return Equal(a, b) && Any();
+    WALKER_PRIMITIVE("Not");
+    return !Equal(v) && Any();
+}
+
+bool Parser::Not(std::pair<char, char> range)
+{
+    WALKER_PRIMITIVE("Not");
+    return !Equal(range) && Any();
+}
+
+bool Parser::Not(const CharSet& set)
+{
+    WALKER_PRIMITIVE("Not");
+    return !Equal(set) && Any();
+}
+
+bool Parser::Not(char a, char b)
+{
+    WALKER_PRIMITIVE("Not");
+    return !Equal(a, b) && Any();
+}
+
+bool Parser::Not(char a)
+{
+    WALKER_PRIMITIVE("Not");
+    return !Equal(a) && Any();
+}
+
+bool Parser::Match(std::string_view v)
+{
+    WALKER_PRIMITIVE("Match");
+    if (Equal(v)) {
+        Advance(v.size());
+        return true;
+    }
+    return Miss(Expect::Literal, 0, 0, v);
+}
+
+bool Parser::Match(const Patterns& set)
+{
+    WALKER_PRIMITIVE("Match");
+    size_t which;
+    return Match(set, which);
+}
+
+bool Parser::Match(const Patterns& set, size_t& which)
+{
+    WALKER_PRIMITIVE("Match");
+    if (Equal(set, which)) {
+        Advance(set.patterns[which].size());
+        return true;
+    }
+    return Miss(Expect::Name, 0, 0);
+}
+
+bool Parser::Match(std::pair<char, char> range)
+{
+    WALKER_PRIMITIVE("Match");
+    return (Equal(range) && Any()) || Miss(Expect::Range, range.first, range.second);
+}
+
+bool Parser::Match(const CharSet& set)
+{
+    WALKER_PRIMITIVE("Match");
+    return (Equal(set) && Any()) || Miss(Expect::Name, 0, 0);
+}
+
+bool Parser::Match(char a, char b)
+{
+    WALKER_PRIMITIVE("Match");
+    if (Accept(a, b)) {
+        return true;
+    }
+    Miss(Expect::Char, a, a);
+    return Miss(Expect::Char, b, b);
 }
 
 bool Parser::Match(char a)
+{
+    WALKER_PRIMITIVE("Match");
+    return Accept(a) || Miss(Expect::Char, a, a);
+}
+
+bool Parser::Accept(char a, char b)
+{
+    return Equal(a, b) && Any();
+}
+
+bool Parser::Accept(char a)
 {
     return Equal(a) && Any();
 }
@@ -349,23 +2462,50 @@ bool Parser::Equal(std::string_view v)
     return text.substr(0, v.size()) == v;
 }
 
+bool Parser::Equal(const Patterns& set)
+{
+    size_t which;
+    return Equal(set, which);
+}
+
+bool Parser::Equal(const Patterns& set, size_t& which)
+{
+    auto i = set.Longest(text.data(), End());
+    if (i == set.Size()) {
+        return false;
+    }
+    which = i;
+    return true;
+}
+
 bool Parser::Equal(std::pair<char, char> range)
 {
-    return Curr() >= range.first && Curr() <= range.second;
+    return More() && In(Curr(), range);
+}
+
+bool Parser::In(char c, std::pair<char, char> range)
+{
+    return c >= range.first && c <= range.second;
+}
+
+bool Parser::Equal(const CharSet& set)
+{
+    return More() && set.Has(Curr());
 }
 
 bool Parser::Equal(char a, char b)
 {
-    return Curr() == a || Curr() == b;
+    return More() && (Curr() == a || Curr() == b);
 }
 
 bool Parser::Equal(char a)
 {
-    return Curr() == a;
+    return More() && Curr() == a;
 }
 
 bool Parser::Any()
 {
+    WALKER_PRIMITIVE("Any");
     if (More()) {
         Next();
         return true;
@@ -373,14 +2513,114 @@ bool Parser::Any()
     return false;
 }
 
-std::string_view Parser::Mark()
+bool Parser::AnyRune()
 {
-    return text;
+    uint32_t code;
+    return AnyRune(code);
+}
+
+bool Parser::AnyRune(uint32_t& out)
+{
+    WALKER_PRIMITIVE("AnyRune");
+    auto p = text.data();
+    auto q = scan::Decode(p, End(), out);
+    if (q == p) {
+        return Miss(Expect::Name, 0, 0, "UTF-8");
+    }
+    Seek(q);
+    return true;
+}
+
+bool Parser::ValidUtf8()
+{
+    WALKER_PRIMITIVE("ValidUtf8");
+    auto p = scan::FindInvalidUtf8(text.data(), End());
+    if (p == End()) {
+        return true;
+    }
+    // Fails at the invalid sequence without moving there.
+    auto m = text;
+    Seek(p);
+    Fail("UTF-8");
+    text = m;
+    return false;
+}
+
+bool Parser::Match(const UnicodeClass& set)
+{
+    WALKER_PRIMITIVE("Match");
+    auto p = text.data();
+    uint32_t code;
+    auto q = scan::Decode(p, End(), code);
+    if (q != p && set.Has(code)) {
+        Seek(q);
+        return true;
+    }
+    return Miss(Expect::Name, 0, 0);
+}
+
+bool Parser::MatchRune(uint32_t code)
+{
+    WALKER_PRIMITIVE("MatchRune");
+    auto p = text.data();
+    uint32_t c;
+    auto q = scan::Decode(p, End(), c);
+    if (q != p && c == code) {
+        Seek(q);
+        return true;
+    }
+    return Miss(Expect::Name, 0, 0);
+}
+
+bool Parser::While(const UnicodeClass& set)
+{
+    WALKER_PRIMITIVE("While");
+    auto m = Mark();
+    auto p = text.data();
+    auto e = End();
+    for (;;) {
+        // Non-ASCII characters stop the scan, as the set has none.
+        p = scan::FindNotIn(p, e, set.Ascii().Table());
+        uint32_t code;
+        auto q = p == e || (unsigned char)*p < 0x80 ? p : scan::Decode(p, e, code);
+        if (q == p || !set.Has(code)) {
+            break;
+        }
+        p = q;
+    }
+    Seek(p);
+    return Moved(m);
+}
+
+template <typename T>
+T Parser::Mark()
+{
+    static_assert(std::is_same_v<T, std::string_view> || std::is_same_v<T, Pos>);
+    if constexpr (std::is_same_v<T, Pos>) {
+        assert(base.size() <= UINT32_MAX && "Text too large for 32-bit offsets");
+        return { uint32_t(text.data() - base.data()) };
+    } else {
+        return text;
+    }
 }
 
 void Parser::Back(std::string_view m)
 {
+#ifdef WALKER_PROFILE
+    if (m.size() > text.size()) {
+        profile::Backtrack(m.size() - text.size());
+    }
+#endif
+    reach = std::min(reach, text.size());
     text = m;
+    if (tree) {
+        tree->Rewind(Offset(m));
+    }
+}
+
+void Parser::Back(Pos m)
+{
+    Back(View(m));
 }
 
 bool Parser::Moved(std::string_view m)
@@ -388,19 +2628,135 @@ bool Parser::Moved(std::string_view m)
     return m.size() != text.size();
 }
 
+bool Parser::Moved(Pos m)
+{
+    return base.data() + m.offset != text.data();
+}
+
 std::string_view Parser::Token(std::string_view m)
 {
     return m.substr(0, m.size() - text.size());
 }
 
+std::string_view Parser::Token(Pos m)
+{
+    return base.substr(m.offset, text.data() - base.data() - m.offset);
+}
+
+std::string_view Parser::View(Pos m)
+{
+    return base.substr(m.offset);
+}
+
 std::string_view Parser::Tail()
 {
     return text;
 }
 
+size_t Parser::Offset(std::string_view m)
+{
+    return m.data() - base.data();
+}
+
+Location Parser::Locate(std::string_view m)
+{
+    if (!indexed) {
+        auto e = base.data() + base.size();
+        for (auto p = scan::Find(base.data(), e, '\n'); p != e; p = scan::Find(p + 1, e, '\n')) {
+            lines.push_back(p - base.data());
+        }
+        indexed = true;
+    }
+    auto offset = Offset(m);
+    auto line = std::lower_bound(lines.begin(), lines.end(), offset) - lines.begin();
+    auto start = line ? lines[line - 1] + 1 : 0;
+    return { size_t(line) + 1, offset - start + 1 };
+}
+
+bool Parser::Fail(std::string_view what)
+{
+    Record(Expect::Name, 0, 0, what);
+    return false;
+}
+
+bool Parser::Miss([[maybe_unused]] Expect::Kind kind, [[maybe_unused]] char lo, [[maybe_unused]] char hi,
+    [[maybe_unused]] std::string_view what)
+{
+#ifdef WALKER_EXPECTED
+    Record(kind, lo, hi, what);
+#else
+    // Kept small so failing primitives can still be inlined.
+    reach = std::min(reach, text.size());
+    auto offset = Offset(text);
+    if (offset > failure) {
+        failure = offset;
+        expects.clear();
+        whats.clear();
+    }
+#endif
+    return false;
+}
+
+void Parser::Record(Expect::Kind kind, char lo, char hi, std::string_view what)
+{
+    reach = std::min(reach, text.size());
+    auto offset = Offset(text);
+    if (offset < failure) {
+        return;
+    }
+    if (offset > failure) {
+        failure = offset;
+        expects.clear();
+        whats.clear();
+    }
+    if (kind == Expect::Name && what.empty()) {
+        return;
+    }
+    uint32_t code = kind | uint32_t((unsigned char)lo) << 8 | uint32_t((unsigned char)hi) << 16;
+    for (auto& e : expects) {
+        if (e.code == code && std::string_view(whats).substr(e.at, e.size) == what) {
+            return;
+        }
+    }
+    if (expects.size() < maxExpects) {
+        expects.push_back({ code, uint32_t(whats.size()), uint32_t(what.size()) });
+        whats += what;
+    }
+}
+
+std::string_view Parser::Failure()
+{
+    return base.substr(failure);
+}
+
+const std::vector<std::string>& Parser::Expected()
+{
+    expected.clear();
+    for (auto& e : expects) {
+        auto what = std::string_view(whats).substr(e.at, e.size);
+        switch (e.kind()) {
+        case Expect::Name:
+            expected.emplace_back(what);
+            break;
+        case Expect::Literal:
+            expected.push_back("\"" + std::string(what) + "\"");
+            break;
+        case Expect::Char:
+            expected.push_back({ '\'', e.lo(), '\'' });
+            break;
+        case Expect::Range:
+            expected.push_back({ '\'', e.lo(), '\'', '-', '\'', e.hi(), '\'' });
+            break;
+        }
+    }
+    return expected;
+}
+
 char Parser::Curr()
 {
-    return text.front();
+    // Checks first even when padded, as the byte after a view may be
+    // more text and an empty view may have no data.
+    return More() ? text.front() : '\0';
 }
 
 void Parser::Next()
@@ -408,7 +2764,7 @@ void Parser::Next()
     text.remove_prefix(1);
 }
 
-void Parser::Advance(int n)
+void Parser::Advance(size_t n)
 {
     text.remove_prefix(n);
 }
@@ -418,4 +2774,329 @@ bool Parser::More()
     return !text.empty();
 }
 
+void Parser::Seek(const char* p)
+{
+    text.remove_prefix(p - text.data());
+}
+
+const char* Parser::End()
+{
+    return text.data() + text.size();
+}
+
+template <typename F>
+bool Memo::Run(Parser& p, uint16_t rule, F f)
+{
+    auto m = p.Mark();
+    auto at = p.Offset(m);
+    auto& table = at < split ? front : back;
+    auto key = Key(at < split ? at : m.size(), rule);
+    if (auto it = table.find(key); it != table.end()) {
+        p.reach = std::min(p.reach, m.size() - it->second.examined);
+        p.Advance(it->second.length);
+        return it->second.ok;
+    }
+    // Tracks how far this rule looks, then adds it to the enclosing rule.
+    auto reach = p.reach;
+    p.reach = m.size();
+    bool ok = f();
+    auto end = std::min(p.reach, p.Tail().size());
+    Entry e = { ok, m.size() - p.Tail().size(), m.size() - end };
+    if (table.emplace(key, e).second) {
+        if (&table == &front) {
+            reaches.emplace(at + e.examined, key);
+        } else {
+            backs.insert(key);
+        }
+    }
+    p.reach = std::min(reach, end);
+    return ok;
+}
+
+Memo::Memo(size_t lookahead)
+    : lookahead(lookahead)
+{
+}
+
+void Memo::Clear()
+{
+    split = SIZE_MAX;
+    edited = SIZE_MAX;
+    front.clear();
+    back.clear();
+    reaches.clear();
+    backs.clear();
+}
+
+void Memo::Edit(size_t size, size_t offset, size_t removed, size_t inserted)
+{
+    assert(offset + removed <= size && "Edit past the end of the text");
+    assert((edited == SIZE_MAX || size == edited) && "Edit of a text other than the last edited one");
+    edited = size - removed + inserted;
+    // Moves the rules of the back that start before the edit to the front.
+    if (offset > split) {
+        for (auto it = backs.lower_bound(Key(size - offset + 1, 0)); it != backs.end(); it = backs.erase(it)) {
+            auto node = back.extract(*it);
+            auto start = size - (node.key() >> 16);
+            node.key() = Key(start, node.key());
+            reaches.emplace(start + node.mapped().examined, node.key());
+            front.insert(std::move(node));
+        }
+    }
+    // Forgets the rules of the front that looked at the edit, and moves
+    // the ones that start after it to the back.
+    auto near = offset > lookahead ? offset - lookahead : 0;
+    for (auto it = reaches.lower_bound({ near, 0 }); it != reaches.end(); it = reaches.erase(it)) {
+        auto node = front.extract(it->second);
+        auto start = node.key() >> 16;
+        if (start >= offset + removed) {
+            node.key() = Key(size - start, node.key());
+            backs.insert(node.key());
+            back.insert(std::move(node));
+        }
+    }
+    // Forgets the rules of the back that start in the removed characters.
+    for (auto it = backs.lower_bound(Key(size - offset - removed + 1, 0)); it != backs.end(); it = backs.erase(it)) {
+        back.erase(*it);
+    }
+    split = offset;
+}
+
+uint64_t Memo::Key(size_t at, uint64_t rule)
+{
+    return uint64_t(at) << 16 | (rule & 0xFFFF);
+}
+
+#ifdef WALKER_PROFILE
+namespace profile {
+
+// Counters of one thread, indexed by id.
+struct Table {
+    Table();
+    ~Table();
+    // Returns the counters with the id, adding them if needed.
+    // Must be called with the lock held.
+    Counters& At(uint32_t id);
+
+    // Guards the counters, which Snapshot reads from other threads.
+    // Only contended while a snapshot is taken.
+    std::mutex mutex;
+    std::vector<Counters> counters;
+    // Ids of the calls in progress, innermost last.
+    std::vector<uint32_t> open;
+    bool inPrimitive = false;
+};
+
+struct Registry {
+    std::mutex mutex;
+    // Names are copied so they outlive the parsers.
+    std::deque<std::string> names;
+    std::vector<bool> rules;
+    std::unordered_map<std::string, uint32_t> ids[2];
+    std::vector<Table*> tables;
+    // Sums of the threads that finished.
+    std::vector<Counters> finished;
+};
+
+Registry& Global()
+{
+    static Registry registry;
+    return registry;
+}
+
+thread_local Table table;
+
+void Add(Counters& to, const Counters& from)
+{
+    to.calls += from.calls;
+    to.successes += from.successes;
+    to.bytes += from.bytes;
+    to.backtracks += from.backtracks;
+    to.backtracked += from.backtracked;
+}
+
+Table::Table()
+{
+    auto& r = Global();
+    std::lock_guard lock(r.mutex);
+    r.tables.push_back(this);
+}
+
+Table::~Table()
+{
+    auto& r = Global();
+    std::lock_guard lock(r.mutex);
+    r.finished.resize(std::max(r.finished.size(), counters.size()));
+    for (size_t i = 0; i < counters.size(); i++) {
+        Add(r.finished[i], counters[i]);
+    }
+    r.tables.erase(std::find(r.tables.begin(), r.tables.end(), this));
+}
+
+Counters& Table::At(uint32_t id)
+{
+    if (counters.size() <= id) {
+        counters.resize(id + 1);
+    }
+    return counters[id];
+}
+
+uint32_t Id(std::string_view name, bool rule)
+{
+    auto& r = Global();
+    std::lock_guard lock(r.mutex);
+    if (r.names.empty()) {
+        r.names.push_back("(none)");
+        r.rules.push_back(true);
+    }
+    auto [it, added] = r.ids[rule].emplace(name, r.names.size());
+    if (added) {
+        r.names.emplace_back(name);
+        r.rules.push_back(rule);
+    }
+    return it->second;
+}
+
+std::string_view Name(uint32_t id)
+{
+    auto& r = Global();
+    std::lock_guard lock(r.mutex);
+    return r.names[id];
+}
+
+Scope::Scope(uint32_t id, bool primitive, const std::string_view& text)
+    : id(id)
+    , active(!(primitive && table.inPrimitive))
+    , primitive(primitive)
+    , text(text)
+    , start(text.size())
+{
+    if (active) {
+        table.open.push_back(id);
+        table.inPrimitive = primitive;
+    }
+}
+
+Scope::~Scope()
+{
+    if (!active) {
+        return;
+    }
+    table.open.pop_back();
+    if (primitive) {
+        table.inPrimitive = false;
+    }
+    std::lock_guard lock(table.mutex);
+    auto& c = table.At(id);
+    auto n = start > text.size() ? start - text.size() : 0;
+    c.calls++;
+    c.successes += outcome < 0 ? n > 0 : outcome;
+    c.bytes += n;
+}
+
+bool Scope::Done(bool ok)
+{
+    outcome = ok;
+    return ok;
+}
+
+void Backtrack(size_t n)
+{
+    auto id = table.open.empty() ? 0 : table.open.back();
+    std::lock_guard lock(table.mutex);
+    auto& c = table.At(id);
+    c.backtracks++;
+    c.backtracked += n;
+}
+
+std::vector<Counters> Snapshot()
+{
+    auto& r = Global();
+    std::lock_guard lock(r.mutex);
+    std::vector<Counters> all(r.names.size());
+    for (size_t i = 0; i < all.size(); i++) {
+        all[i].name = r.names[i];
+        all[i].rule = r.rules[i];
+        if (i < r.finished.size()) {
+            Add(all[i], r.finished[i]);
+        }
+    }
+    // Tables are unregistered under the registry lock, so the ones
+    // listed are alive.
+    for (auto t : r.tables) {
+        std::lock_guard tableLock(t->mutex);
+        for (size_t i = 0; i < all.size() && i < t->counters.size(); i++) {
+            Add(all[i], t->counters[i]);
+        }
+    }
+    std::stable_sort(all.begin(), all.end(), [](auto& a, auto& b) {
+        return a.backtracked != b.backtracked ? a.backtracked > b.backtracked : a.calls > b.calls;
+    });
+    return all;
+}
+
+std::string Report()
+{
+    // Pads the value to the width of its column.
+    auto cell = [](std::string v, size_t width, bool left = false) {
+        auto pad = std::string(width > v.size() ? width - v.size() : 0, ' ');
+        return left ? v + pad : pad + v;
+    };
+    std::string out = cell("name", 24, true) + cell("kind", 10, true) + cell("calls", 12) + cell("successes", 12)
+        + cell("bytes", 14) + cell("backtracks", 12) + cell("backtracked", 14) + "\n";
+    for (auto& c : Snapshot()) {
+        if (c.calls == 0 && c.backtracks == 0) {
+            continue;
+        }
+        out += cell(std::string(c.name), 24, true) + cell(c.rule ? "rule" : "primitive", 10, true)
+            + cell(std::to_string(c.calls), 12) + cell(std::to_string(c.successes), 12)
+            + cell(std::to_string(c.bytes), 14) + cell(std::to_string(c.backtracks), 12)
+            + cell(std::to_string(c.backtracked), 14) + "\n";
+    }
+    return out;
+}
+
+std::string ReportJson()
+{
+    std::string out = "[";
+    for (auto& c : Snapshot()) {
+        if (c.calls == 0 && c.backtracks == 0) {
+            continue;
+        }
+        out += out.size() > 1 ? ",\n" : "\n";
+        out += "  {\"name\": \"";
+        for (auto ch : c.name) {
+            if ((unsigned char)ch < 0x20) {
+                out += "\\u00";
+                out += "0123456789abcdef"[ch >> 4];
+                out += "0123456789abcdef"[ch & 15];
+                continue;
+            }
+            if (ch == '"' || ch == '\\') {
+                out += '\\';
+            }
+            out += ch;
+        }
+        out += std::string("\", \"kind\": \"") + (c.rule ? "rule" : "primitive") + "\"";
+        out += ", \"calls\": " + std::to_string(c.calls);
+        out += ", \"successes\": " + std::to_string(c.successes);
+        out += ", \"bytes\": " + std::to_string(c.bytes);
+        out += ", \"backtracks\": " + std::to_string(c.backtracks);
+        out += ", \"backtracked\": " + std::to_string(c.backtracked) + "}";
+    }
+    return out + "\n]\n";
+}
+
+void Reset()
+{
+    auto& r = Global();
+    std::lock_guard lock(r.mutex);
+    r.finished.clear();
+    std::lock_guard tableLock(table.mutex);
+    table.counters.clear();
+}
+
+}
+#endif
+
 #endif